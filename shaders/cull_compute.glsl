@@ -0,0 +1,93 @@
+#version 430 core
+layout(local_size_x = 64) in;
+
+struct Cluster
+{
+    vec4 boxMin;
+    vec4 boxMax;
+    vec4 cone; // axis (xyz) and cutoff (w)
+    uint first; // first vertex in the cluster's page
+    uint count;
+    uint batch;
+    uint commandBase; // first command slot of the batch
+    uint instance;    // transform, selected through baseInstance
+    uint page;        // vertex buffer page, drawn by the batch
+    uint padding0;
+    uint padding1;
+};
+
+struct DrawCommand
+{
+    uint count;
+    uint instanceCount;
+    uint first;
+    uint baseInstance;
+};
+
+layout(std430, binding = 0) readonly buffer Clusters
+{
+    Cluster clusters[];
+};
+
+layout(std430, binding = 1) writeonly buffer Commands
+{
+    DrawCommand commands[];
+};
+
+layout(std430, binding = 2) buffer DrawCounts
+{
+    uint drawCounts[]; // one per batch
+};
+
+uniform vec4 frustumPlanes[6];
+uniform vec3 cameraPos;
+uniform uint clusterCount;
+uniform int  useConeCulling;
+uniform int  compact; // 1: append survivors per batch, 0: write in place
+
+bool boxVisible(vec3 boxMin, vec3 boxMax)
+{
+    for (int i = 0; i < 6; i++)
+    {
+        vec4 p = frustumPlanes[i];
+        vec3 v = mix(boxMin, boxMax, greaterThan(p.xyz, vec3(0.0)));
+        if (dot(p.xyz, v) + p.w < 0.0) return false;
+    }
+    return true;
+}
+
+bool coneBackfacing(Cluster c)
+{
+    if (c.cone.w >= 1.0) return false;
+
+    vec3  center   = (c.boxMin.xyz + c.boxMax.xyz) * 0.5;
+    float radius   = length(c.boxMax.xyz - center);
+    vec3  toCenter = center - cameraPos;
+    return dot(toCenter, c.cone.xyz) >= c.cone.w * length(toCenter) + radius;
+}
+
+void main()
+{
+    uint id = gl_GlobalInvocationID.x;
+    if (id >= clusterCount) return;
+
+    Cluster c       = clusters[id];
+    bool    visible = boxVisible(c.boxMin.xyz, c.boxMax.xyz);
+    if (visible && useConeCulling == 1) visible = !coneBackfacing(c);
+
+    DrawCommand cmd;
+    cmd.count         = c.count;
+    cmd.instanceCount = visible ? 1u : 0u;
+    cmd.first         = c.first;
+    cmd.baseInstance  = c.instance;
+
+    if (compact == 1)
+    {
+        if (visible)
+            commands[c.commandBase + atomicAdd(drawCounts[c.batch], 1u)] = cmd;
+    }
+    else
+    {
+        commands[id] = cmd;
+    }
+}
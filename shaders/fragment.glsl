@@ -1,6 +1,7 @@
 #version 420 core
 in vec3      FragPos;
 in vec3      Normal;
+in vec2      TexCoord;
 flat in vec3 randColorSeed;
 
 out vec4 FragColor;
@@ -12,6 +13,24 @@ uniform int  useShading;
 uniform int  useDepthBuffer;
 uniform int  useRandomColor;
 
+// Material textures, bound per batch while their mips stream in
+uniform sampler2D diffuseMap;
+uniform sampler2D normalMap; // BC5, tangent-space xy
+uniform int       useDiffuseMap;
+uniform int       useNormalMap;
+
+// Clustered point lights, see ClusteredLighting in lights.h
+uniform samplerBuffer  lightData;    // (position, radius), (color, intensity)
+uniform usamplerBuffer lightGrid;    // (offset, count) per froxel
+uniform usamplerBuffer lightIndices; // light ids referenced by lightGrid
+uniform int            lightCount;
+uniform int            useClustering;
+uniform uvec3          gridSize;
+uniform vec2           screenSize;
+uniform vec2           tileOffset;   // of a tile within the screen
+uniform float          zNear;
+uniform float          zFar;
+
 vec3 randColor(vec3 seed)
 {
     // Improved random function with better distribution
@@ -28,6 +47,77 @@ vec3 randColor(vec3 seed)
     return 0.3 + 0.7 * fracted;  // Range: 0.3 to 1.0 instead of 0.0 to 1.0
 }
 
+// Tangent frame from screen-space derivatives, so meshes need no tangent
+// attribute for normal mapping
+mat3 cotangentFrame(vec3 N, vec3 p, vec2 uv)
+{
+    vec3 dp1  = dFdx(p);
+    vec3 dp2  = dFdy(p);
+    vec2 duv1 = dFdx(uv);
+    vec2 duv2 = dFdy(uv);
+
+    vec3  dp2perp = cross(dp2, N);
+    vec3  dp1perp = cross(N, dp1);
+    vec3  T       = dp2perp * duv1.x + dp1perp * duv2.x;
+    vec3  B       = dp2perp * duv1.y + dp1perp * duv2.y;
+    float invmax  = inversesqrt(max(max(dot(T, T), dot(B, B)), 1e-20));
+    return mat3(T * invmax, B * invmax, N);
+}
+
+vec3 pointLight(int index, vec3 norm, vec3 viewDir, vec3 materialColor)
+{
+    vec4  posRadius = texelFetch(lightData, index * 2);
+    vec4  color     = texelFetch(lightData, index * 2 + 1);
+    vec3  toLight   = posRadius.xyz - FragPos;
+    float dist      = length(toLight);
+    if (dist >= posRadius.w) return vec3(0.0);
+
+    float falloff = 1.0 - dist / posRadius.w;
+    falloff *= falloff;
+
+    vec3  lightDir   = toLight / dist;
+    float diff       = max(dot(norm, lightDir), 0.0);
+    vec3  reflectDir = reflect(-lightDir, norm);
+    float spec       = pow(max(dot(viewDir, reflectDir), 0.0), 32);
+    return (diff * materialColor + 0.5 * spec) * color.rgb * color.a * falloff;
+}
+
+uint froxelIndex()
+{
+    // Linear depth from the depth buffer value, then exponential slicing
+    float ndcZ  = gl_FragCoord.z * 2.0 - 1.0;
+    float depth = 2.0 * zNear * zFar / (zFar + zNear - ndcZ * (zFar - zNear));
+    uint  z     = uint(max(log(depth / zNear) / log(zFar / zNear), 0.0) *
+                  float(gridSize.z));
+    vec2  pixel = gl_FragCoord.xy + tileOffset;
+    uvec2 xy    = uvec2(pixel / screenSize * vec2(gridSize.xy));
+    xy          = min(xy, gridSize.xy - 1u);
+    z           = min(z, gridSize.z - 1u);
+    return (z * gridSize.y + xy.y) * gridSize.x + xy.x;
+}
+
+vec3 localLights(vec3 norm, vec3 viewDir, vec3 materialColor)
+{
+    vec3 result = vec3(0.0);
+    if (lightCount == 0) return result;
+
+    if (useClustering == 1)
+    {
+        uvec2 cell = texelFetch(lightGrid, int(froxelIndex())).xy;
+        for (uint i = 0u; i < cell.y; i++)
+        {
+            int index = int(texelFetch(lightIndices, int(cell.x + i)).r);
+            result += pointLight(index, norm, viewDir, materialColor);
+        }
+    }
+    else
+    {
+        for (int i = 0; i < lightCount; i++)
+            result += pointLight(i, norm, viewDir, materialColor);
+    }
+    return result;
+}
+
 void main()
 {
     if (useDepthBuffer == 1)
@@ -43,9 +133,18 @@ void main()
         // Phong shading
         vec3 norm     = normalize(Normal);
         vec3 lightDir = normalize(lightPos - FragPos);
+
+        if (useNormalMap == 1)
+        {
+            vec3 n = vec3(texture(normalMap, TexCoord).rg * 2.0 - 1.0, 0.0);
+            n.z    = sqrt(max(1.0 - dot(n.xy, n.xy), 0.0));
+            norm   = normalize(cotangentFrame(norm, FragPos, TexCoord) * n);
+        }
         
         // Choose color based on mode
         vec3 materialColor = (useRandomColor == 1) ? randColor(randColorSeed) : baseColor;
+        if (useDiffuseMap == 1 && useRandomColor == 0)
+            materialColor = texture(diffuseMap, TexCoord).rgb;
         
         // Ambient
         float ambientStrength = 0.3;
@@ -62,7 +161,8 @@ void main()
         float spec             = pow(max(dot(viewDir, reflectDir), 0.0), 32);
         vec3  specular         = specularStrength * spec * vec3(1.0);
         
-        vec3 result = ambient + diffuse + specular;
+        vec3 result = ambient + diffuse + specular +
+                      localLights(norm, viewDir, materialColor);
         FragColor   = vec4(result, 1.0);
     }
     else if (useRandomColor == 1)
@@ -0,0 +1,10 @@
+#version 420 core
+in vec2 TexCoords;
+out vec4 color;
+
+// Premultiplied overlay, composited with (ONE, ONE_MINUS_SRC_ALPHA)
+uniform sampler2D overlay;
+
+void main() {
+    color = texture(overlay, TexCoords);
+}
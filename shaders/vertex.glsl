@@ -1,9 +1,12 @@
 #version 420 core
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoord;
+layout(location = 3) in mat4 aInstance; // per instance, 3-6
 
 out vec3      FragPos;
 out vec3      Normal;
+out vec2      TexCoord;
 flat out vec3 randColorSeed;
 
 uniform mat4 model;
@@ -13,8 +16,10 @@ uniform int  useRandomColor;
 
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal  = mat3(transpose(inverse(model))) * aNormal;
+    mat4 world = model * aInstance;
+    FragPos  = vec3(world * vec4(aPos, 1.0));
+    Normal   = mat3(transpose(inverse(world))) * aNormal;
+    TexCoord = aTexCoord;
     gl_Position = projection * view * vec4(FragPos, 1.0);
     
     // Use triangle ID instead of vertex position for better randomization
@@ -0,0 +1,140 @@
+#pragma once
+#include "mesh.h"
+#include "options.h"
+#include "postprocess.h"
+#include "thread_pool.h"
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// CPU half of batch rendering: finding models and turning each one into a
+// vertex soup, so workers can prepare the next models while the GL thread
+// renders the current one.
+
+// Every file Assimp can import under `input` when it is a directory,
+// otherwise the paths listed in the file at `input`, one per line
+inline std::vector<std::string> collect_model_paths(const std::string& input)
+{
+    namespace fs = std::filesystem;
+    std::vector<std::string> paths;
+
+    std::error_code ec;
+    if (fs::is_directory(input, ec))
+    {
+        Assimp::Importer importer;
+        fs::recursive_directory_iterator it(input, ec), end;
+        for (; !ec && it != end; it.increment(ec))
+        {
+            if (!it->is_regular_file(ec)) continue;
+            std::string ext = it->path().extension().string();
+            // Sidecar files (materials, KTX2 caches) are not models
+            if (!ext.empty() && ext != ".mtl" && ext != ".ktx2" &&
+                importer.IsExtensionSupported(ext))
+                paths.push_back(it->path().string());
+        }
+        std::sort(paths.begin(), paths.end());
+        return paths;
+    }
+
+    std::ifstream f(input);
+    if (!f)
+    {
+        std::cerr << "Failed to open model list " << input << '\n';
+        return paths;
+    }
+    std::string line;
+    while (std::getline(f, line))
+    {
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (!line.empty() && line[0] != '#') paths.push_back(line);
+    }
+    return paths;
+}
+
+struct LoadedModel
+{
+    std::string        path;
+    std::string        error; // empty on success
+    VertexFormat       fmt;
+    std::vector<float> vertices;
+    glm::vec3          boxMin = glm::vec3(FLT_MAX);
+    glm::vec3          boxMax = glm::vec3(-FLT_MAX);
+    double             loadMs = 0.0;
+};
+
+// Imports, post-processes and flattens one model. Runs on a worker; the
+// importer and scene are freed before returning.
+inline LoadedModel load_model_geometry(const std::string& path,
+                                       const Options&     opts,
+                                       ThreadPool&        pool)
+{
+    auto        start = std::chrono::steady_clock::now();
+    LoadedModel model;
+    model.path = path;
+
+    unsigned int flags = aiProcess_Triangulate | aiProcess_FlipUVs;
+    if (opts.assimpPost)
+        flags |= aiProcess_GenNormals | aiProcess_JoinIdenticalVertices;
+
+    Assimp::Importer importer;
+    const aiScene*   scene = importer.ReadFile(path, flags);
+    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
+        !scene->mRootNode)
+    {
+        model.error = importer.GetErrorString();
+        return model;
+    }
+    if (!opts.assimpPost)
+        post_process_scene(scene, opts.weldEpsilon, opts.normals, pool);
+
+    // Thumbnails draw a single world-space soup
+    std::vector<float>        local;
+    std::vector<DrawRange>    ranges;
+    std::vector<MeshInstance> instances;
+    model.fmt = analyzeScene(scene);
+    extractVertices(scene, model.fmt, local, ranges, instances);
+    model.vertices = expandInstances(local, model.fmt, ranges, instances);
+    if (model.vertices.empty())
+    {
+        model.error = "no triangles";
+        return model;
+    }
+
+    PositionStreams positions = model.fmt.ops->positions(model.vertices, pool);
+    stream_bounds(positions, 0, positions.size(), model.boxMin, model.boxMax);
+
+    model.loadMs = std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+    return model;
+}
+
+// Output name for a model: its path relative to the input directory with
+// separators flattened, so models with the same file name do not collide
+inline std::string thumbnail_name(const std::string& modelPath,
+                                  const std::string& input)
+{
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    fs::path        rel = fs::is_directory(input, ec)
+                              ? fs::relative(modelPath, input, ec)
+                              : fs::path(modelPath).relative_path();
+    if (ec || rel.empty()) rel = fs::path(modelPath).filename();
+
+    std::string name = rel.replace_extension().string();
+    std::replace_if(
+        name.begin(),
+        name.end(),
+        [](char c) { return c == '/' || c == '\\' || c == ':'; },
+        '_');
+    return name;
+}
@@ -0,0 +1,961 @@
+#pragma once
+#include "mesh.h"
+#include "thread_pool.h"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <numeric>
+#include <vector>
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define BVH_SSE 1
+#endif
+
+// Triangle BVH over the interleaved vertex soup, for CPU ray queries
+// (picking, focus, camera collision). Built with binned SAH on the pool.
+// SceneBvh adds a top level over mesh instances.
+
+struct BvhNode
+{
+    glm::vec3 boxMin;
+    uint32_t  leftFirst; // first triangle for leaves, left child otherwise
+    glm::vec3 boxMax;
+    uint32_t  count;     // triangles in a leaf, 0 for inner nodes
+};
+
+struct RayHit
+{
+    float    t        = FLT_MAX;
+    uint64_t triangle = UINT64_MAX; // index into the vertex soup / 3
+    float    u = 0.0f, v = 0.0f;    // barycentrics of vertices 1 and 2
+    uint32_t instance = UINT32_MAX; // set by SceneBvh
+
+    bool valid() const { return triangle != UINT64_MAX; }
+};
+
+// Four floats, one per ray of a packet
+struct Lanes4
+{
+#ifdef BVH_SSE
+    __m128 v;
+
+    Lanes4() = default;
+    Lanes4(__m128 x) : v(x) {}
+    explicit Lanes4(float x) : v(_mm_set1_ps(x)) {}
+    Lanes4(float a, float b, float c, float d) : v(_mm_setr_ps(a, b, c, d)) {}
+
+    friend Lanes4 operator+(Lanes4 a, Lanes4 b) { return _mm_add_ps(a.v, b.v); }
+    friend Lanes4 operator-(Lanes4 a, Lanes4 b) { return _mm_sub_ps(a.v, b.v); }
+    friend Lanes4 operator*(Lanes4 a, Lanes4 b) { return _mm_mul_ps(a.v, b.v); }
+    friend Lanes4 min(Lanes4 a, Lanes4 b) { return _mm_min_ps(a.v, b.v); }
+    friend Lanes4 max(Lanes4 a, Lanes4 b) { return _mm_max_ps(a.v, b.v); }
+
+    // Bit i is set where lane i of a <= b (or a < b)
+    friend int le_mask(Lanes4 a, Lanes4 b)
+    {
+        return _mm_movemask_ps(_mm_cmple_ps(a.v, b.v));
+    }
+    friend int lt_mask(Lanes4 a, Lanes4 b)
+    {
+        return _mm_movemask_ps(_mm_cmplt_ps(a.v, b.v));
+    }
+
+    float operator[](int i) const
+    {
+        alignas(16) float out[4];
+        _mm_store_ps(out, v);
+        return out[i];
+    }
+#else
+    float v[4];
+
+    Lanes4() = default;
+    explicit Lanes4(float x) : v{ x, x, x, x } {}
+    Lanes4(float a, float b, float c, float d) : v{ a, b, c, d } {}
+
+    template <class Op>
+    static Lanes4 map(Lanes4 a, Lanes4 b, Op op)
+    {
+        return { op(a.v[0], b.v[0]),
+                 op(a.v[1], b.v[1]),
+                 op(a.v[2], b.v[2]),
+                 op(a.v[3], b.v[3]) };
+    }
+    friend Lanes4 operator+(Lanes4 a, Lanes4 b)
+    {
+        return map(a, b, [](float x, float y) { return x + y; });
+    }
+    friend Lanes4 operator-(Lanes4 a, Lanes4 b)
+    {
+        return map(a, b, [](float x, float y) { return x - y; });
+    }
+    friend Lanes4 operator*(Lanes4 a, Lanes4 b)
+    {
+        return map(a, b, [](float x, float y) { return x * y; });
+    }
+    friend Lanes4 min(Lanes4 a, Lanes4 b)
+    {
+        return map(a, b, [](float x, float y) { return std::min(x, y); });
+    }
+    friend Lanes4 max(Lanes4 a, Lanes4 b)
+    {
+        return map(a, b, [](float x, float y) { return std::max(x, y); });
+    }
+    friend int le_mask(Lanes4 a, Lanes4 b)
+    {
+        int m = 0;
+        for (int i = 0; i < 4; i++)
+            m |= int(a.v[i] <= b.v[i]) << i;
+        return m;
+    }
+    friend int lt_mask(Lanes4 a, Lanes4 b)
+    {
+        int m = 0;
+        for (int i = 0; i < 4; i++)
+            m |= int(a.v[i] < b.v[i]) << i;
+        return m;
+    }
+
+    float operator[](int i) const { return v[i]; }
+#endif
+};
+
+// Four rays in structure-of-arrays form
+struct RayPacket
+{
+    Lanes4 ox, oy, oz;
+    Lanes4 dx, dy, dz;
+    Lanes4 tMax;
+};
+
+class Bvh
+{
+public:
+    // Node and leaf indices are 32-bit, and a tree has up to two nodes
+    // per triangle; larger inputs get an empty tree instead of wrapping
+    static constexpr size_t MAX_TRIANGLES = UINT32_MAX / 2;
+
+    double BuildMs = 0.0;
+
+    // Triangles are consecutive position triples
+    void build(const PositionStreams& positions, ThreadPool& pool)
+    {
+        build(positions, 0, positions.size(), pool);
+    }
+
+    void build(const PositionStreams& positions,
+               size_t                 first,
+               size_t                 vertexCount,
+               ThreadPool&            pool)
+    {
+        auto   start = std::chrono::steady_clock::now();
+        size_t count = vertexCount / 3;
+        if (count > MAX_TRIANGLES)
+        {
+            std::cerr << "BVH: " << count << " triangles exceed the 32-bit "
+                      << "node indices, ray queries skip them\n";
+            count = 0;
+        }
+
+        std::vector<Triangle>  tris(count);
+        std::vector<glm::vec3> boxMin(count), boxMax(count), centroid(count);
+        pool.parallel_for(
+            count,
+            1 << 14,
+            [&](size_t begin, size_t end)
+            {
+                for (size_t i = begin; i < end; i++)
+                {
+                    size_t    v = first + i * 3;
+                    glm::vec3 a = positions[v], b = positions[v + 1],
+                              c = positions[v + 2];
+                    tris[i]     = { a, b - a, c - a };
+                    boxMin[i]   = glm::min(a, glm::min(b, c));
+                    boxMax[i]   = glm::max(a, glm::max(b, c));
+                    centroid[i] = (boxMin[i] + boxMax[i]) * 0.5f;
+                }
+            });
+
+        ids_.resize(count);
+        std::iota(ids_.begin(), ids_.end(), 0U);
+        nodes_.assign(std::max<size_t>(1, 2 * count), BvhNode{});
+
+        Builder builder{ boxMin, boxMax, centroid, ids_, nodes_, pool, { 1 } };
+        builder.build(0, 0, uint32_t(count));
+        nodes_.resize(builder.nodeCount.load());
+
+        // Leaves index triangles directly in traversal order
+        tris_.resize(count);
+        pool.parallel_for(count,
+                          1 << 14,
+                          [&](size_t begin, size_t end)
+                          {
+                              for (size_t i = begin; i < end; i++)
+                                  tris_[i] = tris[ids_[i]];
+                          });
+
+        BuildMs = std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+    }
+
+    size_t node_count() const { return nodes_.size(); }
+    size_t triangle_count() const { return tris_.size(); }
+
+    // Closest hit along origin + t * dir for t in (0, tMax)
+    bool intersect(const glm::vec3& origin,
+                   const glm::vec3& dir,
+                   float            tMax,
+                   RayHit&          hit) const
+    {
+        hit = RayHit{};
+        if (tris_.empty()) return false;
+        hit.t = tMax;
+
+        glm::vec3 invDir = 1.0f / dir;
+        uint32_t  stack[STACK_SIZE];
+        int       sp   = 0;
+        uint32_t  node = 0;
+        for (;;)
+        {
+            const BvhNode& n = nodes_[node];
+            if (n.count > 0)
+            {
+                for (uint32_t i = n.leftFirst; i < n.leftFirst + n.count; i++)
+                    intersect_triangle(origin, dir, i, hit);
+            }
+            else
+            {
+                // Visit the nearer child first so the far one is often culled
+                uint32_t near = n.leftFirst, far = n.leftFirst + 1;
+                float    tNear = box_distance(nodes_[near], origin, invDir, hit.t);
+                float    tFar  = box_distance(nodes_[far], origin, invDir, hit.t);
+                if (tFar < tNear)
+                {
+                    std::swap(near, far);
+                    std::swap(tNear, tFar);
+                }
+                if (tNear != FLT_MAX)
+                {
+                    if (tFar != FLT_MAX) stack[sp++] = far;
+                    node = near;
+                    continue;
+                }
+            }
+            if (sp == 0) break;
+            node = stack[--sp];
+        }
+        if (hit.valid()) hit.triangle = ids_[hit.triangle];
+        return hit.valid();
+    }
+
+    // Closest hit on the segment from a to b
+    bool intersect_segment(const glm::vec3& a, const glm::vec3& b, RayHit& hit) const
+    {
+        glm::vec3 d   = b - a;
+        float     len = glm::length(d);
+        if (len <= 0.0f) return false;
+        bool found = intersect(a, d / len, len, hit);
+        if (found) hit.t /= len; // as a fraction of the segment
+        return found;
+    }
+
+    // Traverses the tree once for four rays; a node is visited while any
+    // active ray overlaps it. Coherent rays (e.g. a 2x2 pixel block) share
+    // most of their path, so this amortises node fetches and box tests.
+    void intersect4(const RayPacket& packet, RayHit hits[4]) const
+    {
+        for (int i = 0; i < 4; i++)
+            hits[i] = RayHit{};
+        if (tris_.empty()) return;
+
+        Lanes4 invX = Lanes4(1.0f / packet.dx[0], 1.0f / packet.dx[1],
+                             1.0f / packet.dx[2], 1.0f / packet.dx[3]);
+        Lanes4 invY = Lanes4(1.0f / packet.dy[0], 1.0f / packet.dy[1],
+                             1.0f / packet.dy[2], 1.0f / packet.dy[3]);
+        Lanes4 invZ = Lanes4(1.0f / packet.dz[0], 1.0f / packet.dz[1],
+                             1.0f / packet.dz[2], 1.0f / packet.dz[3]);
+        Lanes4 tHit = packet.tMax;
+        for (int i = 0; i < 4; i++)
+            hits[i].t = packet.tMax[i];
+
+        uint32_t stack[STACK_SIZE];
+        int      sp   = 0;
+        uint32_t node = 0;
+        for (;;)
+        {
+            const BvhNode& n = nodes_[node];
+            if (packet_hits_box(n, packet, invX, invY, invZ, tHit))
+            {
+                if (n.count > 0)
+                {
+                    for (uint32_t i = n.leftFirst; i < n.leftFirst + n.count; i++)
+                        intersect_triangle4(packet, i, tHit, hits);
+                }
+                else
+                {
+                    // Order children by the first ray's direction on the
+                    // parent's widest axis
+                    glm::vec3 extent = n.boxMax - n.boxMin;
+                    int       axis   = extent.x > extent.y
+                                           ? (extent.x > extent.z ? 0 : 2)
+                                           : (extent.y > extent.z ? 1 : 2);
+                    float     d      = axis == 0   ? packet.dx[0]
+                                       : axis == 1 ? packet.dy[0]
+                                                   : packet.dz[0];
+                    uint32_t  first  = n.leftFirst + (d < 0.0f ? 1 : 0);
+                    uint32_t  second = d < 0.0f ? n.leftFirst : n.leftFirst + 1;
+                    stack[sp++]      = second;
+                    node             = first;
+                    continue;
+                }
+            }
+            if (sp == 0) break;
+            node = stack[--sp];
+        }
+        for (int i = 0; i < 4; i++)
+            if (hits[i].valid()) hits[i].triangle = ids_[hits[i].triangle];
+    }
+
+private:
+    friend class SceneBvh;
+
+    // Deeper than the builder's forced median splits can reach
+    static constexpr int STACK_SIZE = 128;
+
+    struct Triangle
+    {
+        glm::vec3 v0, e1, e2;
+    };
+
+    // Binned SAH builder. Large nodes bin in parallel and their children
+    // are built concurrently; nodes are claimed in pairs with an atomic
+    // counter, so the final layout does not depend on thread timing beyond
+    // node numbering.
+    struct Builder
+    {
+        static constexpr int      BINS      = 16;
+        static constexpr uint32_t MAX_LEAF  = 8;
+        static constexpr uint32_t PARALLEL  = 4096; // triangles
+        static constexpr uint32_t MAX_DEPTH = 64;   // then split by index
+
+        const std::vector<glm::vec3>& boxMin;
+        const std::vector<glm::vec3>& boxMax;
+        const std::vector<glm::vec3>& centroid;
+        std::vector<uint32_t>&        ids;
+        std::vector<BvhNode>&         nodes;
+        ThreadPool&                   pool;
+        std::atomic<uint32_t>         nodeCount;
+
+        struct Bounds
+        {
+            glm::vec3 lo = glm::vec3(FLT_MAX), hi = glm::vec3(-FLT_MAX);
+
+            void grow(const glm::vec3& a, const glm::vec3& b)
+            {
+                lo = glm::min(lo, a);
+                hi = glm::max(hi, b);
+            }
+            float area() const
+            {
+                glm::vec3 e = hi - lo;
+                return e.x < 0.0f ? 0.0f : e.x * e.y + e.y * e.z + e.z * e.x;
+            }
+        };
+
+        struct Bins
+        {
+            Bounds   box[3][BINS];
+            uint32_t count[3][BINS] = {};
+        };
+
+        void build(uint32_t index, uint32_t first, uint32_t count, uint32_t depth = 0)
+        {
+            // Node and centroid bounds
+            Bounds box, cbox;
+            for_range(first,
+                      count,
+                      [&](uint32_t begin, uint32_t end, Bounds& b, Bounds& c)
+                      {
+                          for (uint32_t i = begin; i < end; i++)
+                          {
+                              b.grow(boxMin[ids[i]], boxMax[ids[i]]);
+                              c.grow(centroid[ids[i]], centroid[ids[i]]);
+                          }
+                      },
+                      box,
+                      cbox);
+
+            BvhNode& node = nodes[index];
+            node.boxMin   = box.lo;
+            node.boxMax   = box.hi;
+            node.leftFirst = first;
+            node.count     = count;
+            if (count <= 2) return;
+
+            glm::vec3 extent = cbox.hi - cbox.lo;
+            Bins      bins   = bin(first, count, cbox.lo, extent);
+
+            // Sweep every axis for the cheapest split plane
+            float bestCost = FLT_MAX;
+            int   bestAxis = -1, bestSplit = 0;
+            for (int a = 0; a < 3; a++)
+            {
+                if (extent[a] <= 0.0f) continue;
+                float    rightArea[BINS];
+                uint32_t rightCount[BINS];
+                Bounds   acc;
+                uint32_t n = 0;
+                for (int b = BINS - 1; b > 0; b--)
+                {
+                    acc.grow(bins.box[a][b].lo, bins.box[a][b].hi);
+                    n += bins.count[a][b];
+                    rightArea[b]  = acc.area();
+                    rightCount[b] = n;
+                }
+                acc = Bounds{};
+                n   = 0;
+                for (int b = 0; b < BINS - 1; b++)
+                {
+                    acc.grow(bins.box[a][b].lo, bins.box[a][b].hi);
+                    n += bins.count[a][b];
+                    float cost = acc.area() * n +
+                                 rightArea[b + 1] * rightCount[b + 1];
+                    if (n > 0 && rightCount[b + 1] > 0 && cost < bestCost)
+                    {
+                        bestCost  = cost;
+                        bestAxis  = a;
+                        bestSplit = b;
+                    }
+                }
+            }
+
+            uint32_t leftCount;
+            if (bestAxis < 0 || depth >= MAX_DEPTH)
+            {
+                // Coincident centroids or a degenerate, very deep branch;
+                // split by index to bound leaf size and traversal depth
+                if (count <= MAX_LEAF) return;
+                leftCount = count / 2;
+            }
+            else
+            {
+                if (bestCost >= box.area() * count && count <= MAX_LEAF)
+                    return;
+                float lo    = cbox.lo[bestAxis];
+                float scale = BINS / extent[bestAxis];
+                auto  mid   = std::partition(
+                    ids.begin() + first,
+                    ids.begin() + first + count,
+                    [&](uint32_t id)
+                    {
+                        int b = std::min(
+                            BINS - 1,
+                            int((centroid[id][bestAxis] - lo) * scale));
+                        return b <= bestSplit;
+                    });
+                leftCount = uint32_t(mid - ids.begin()) - first;
+            }
+
+            uint32_t left  = nodeCount.fetch_add(2);
+            node.leftFirst = left;
+            node.count     = 0;
+
+            if (count >= PARALLEL)
+            {
+                pool.parallel_for(2,
+                                  1,
+                                  [&](size_t begin, size_t end)
+                                  {
+                                      for (size_t c = begin; c < end; c++)
+                                          build_child(left, c, first, count,
+                                                      leftCount, depth + 1);
+                                  });
+            }
+            else
+            {
+                build(left, first, leftCount, depth + 1);
+                build(left + 1, first + leftCount, count - leftCount, depth + 1);
+            }
+        }
+
+        void build_child(uint32_t left,
+                         size_t   child,
+                         uint32_t first,
+                         uint32_t count,
+                         uint32_t leftCount,
+                         uint32_t depth)
+        {
+            if (child == 0) build(left, first, leftCount, depth);
+            else build(left + 1, first + leftCount, count - leftCount, depth);
+        }
+
+        // Reduces two Bounds over [first, first + count), in parallel chunks
+        // when the range is large
+        template <class Fn>
+        void for_range(uint32_t first, uint32_t count, Fn fn, Bounds& a, Bounds& b)
+        {
+            if (count < PARALLEL)
+            {
+                fn(first, first + count, a, b);
+                return;
+            }
+            const uint32_t grain  = PARALLEL;
+            size_t         chunks = (count + grain - 1) / grain;
+            std::vector<Bounds> partA(chunks), partB(chunks);
+            pool.parallel_for(chunks,
+                              1,
+                              [&](size_t begin, size_t end)
+                              {
+                                  for (size_t c = begin; c < end; c++)
+                                      fn(first + uint32_t(c) * grain,
+                                         first + std::min(count,
+                                                          uint32_t(c + 1) * grain),
+                                         partA[c],
+                                         partB[c]);
+                              });
+            for (size_t c = 0; c < chunks; c++)
+            {
+                a.grow(partA[c].lo, partA[c].hi);
+                b.grow(partB[c].lo, partB[c].hi);
+            }
+        }
+
+        void bin_range(uint32_t         begin,
+                       uint32_t         end,
+                       const glm::vec3& lo,
+                       const glm::vec3& extent,
+                       Bins&            bins) const
+        {
+            for (uint32_t i = begin; i < end; i++)
+            {
+                uint32_t id = ids[i];
+                for (int a = 0; a < 3; a++)
+                {
+                    if (extent[a] <= 0.0f) continue;
+                    int b = std::min(
+                        BINS - 1,
+                        int((centroid[id][a] - lo[a]) * (BINS / extent[a])));
+                    bins.box[a][b].grow(boxMin[id], boxMax[id]);
+                    bins.count[a][b]++;
+                }
+            }
+        }
+
+        Bins bin(uint32_t first, uint32_t count, const glm::vec3& lo, const glm::vec3& extent)
+        {
+            Bins bins;
+            if (count < PARALLEL)
+            {
+                bin_range(first, first + count, lo, extent, bins);
+                return bins;
+            }
+            const uint32_t    grain  = PARALLEL;
+            size_t            chunks = (count + grain - 1) / grain;
+            std::vector<Bins> parts(chunks);
+            pool.parallel_for(
+                chunks,
+                1,
+                [&](size_t begin, size_t end)
+                {
+                    for (size_t c = begin; c < end; c++)
+                        bin_range(first + uint32_t(c) * grain,
+                                  first + std::min(count, uint32_t(c + 1) * grain),
+                                  lo,
+                                  extent,
+                                  parts[c]);
+                });
+            for (const Bins& part : parts)
+                for (int a = 0; a < 3; a++)
+                    for (int b = 0; b < BINS; b++)
+                    {
+                        bins.box[a][b].grow(part.box[a][b].lo, part.box[a][b].hi);
+                        bins.count[a][b] += part.count[a][b];
+                    }
+            return bins;
+        }
+    };
+
+    // Entry distance of the ray into the node's box, FLT_MAX on a miss
+    static float box_distance(const BvhNode&   n,
+                              const glm::vec3& origin,
+                              const glm::vec3& invDir,
+                              float            tMax)
+    {
+        glm::vec3 t0    = (n.boxMin - origin) * invDir;
+        glm::vec3 t1    = (n.boxMax - origin) * invDir;
+        glm::vec3 tLo   = glm::min(t0, t1);
+        glm::vec3 tHi   = glm::max(t0, t1);
+        float     enter = std::max(std::max(tLo.x, tLo.y), std::max(tLo.z, 0.0f));
+        float     exit  = std::min(std::min(tHi.x, tHi.y), std::min(tHi.z, tMax));
+        return enter <= exit ? enter : FLT_MAX;
+    }
+
+    // Möller-Trumbore, double-sided
+    void intersect_triangle(const glm::vec3& origin,
+                            const glm::vec3& dir,
+                            uint32_t         i,
+                            RayHit&          hit) const
+    {
+        const Triangle& tri = tris_[i];
+        glm::vec3       p   = glm::cross(dir, tri.e2);
+        float           det = glm::dot(tri.e1, p);
+        if (std::fabs(det) < 1e-12f) return;
+        float     inv = 1.0f / det;
+        glm::vec3 s   = origin - tri.v0;
+        float     u   = glm::dot(s, p) * inv;
+        if (u < 0.0f || u > 1.0f) return;
+        glm::vec3 q = glm::cross(s, tri.e1);
+        float     v = glm::dot(dir, q) * inv;
+        if (v < 0.0f || u + v > 1.0f) return;
+        float t = glm::dot(tri.e2, q) * inv;
+        if (t > 0.0f && t < hit.t) hit = { t, i, u, v };
+    }
+
+    static bool packet_hits_box(const BvhNode&   n,
+                                const RayPacket& r,
+                                Lanes4           invX,
+                                Lanes4           invY,
+                                Lanes4           invZ,
+                                Lanes4           tMax)
+    {
+        Lanes4 x0 = (Lanes4(n.boxMin.x) - r.ox) * invX;
+        Lanes4 x1 = (Lanes4(n.boxMax.x) - r.ox) * invX;
+        Lanes4 y0 = (Lanes4(n.boxMin.y) - r.oy) * invY;
+        Lanes4 y1 = (Lanes4(n.boxMax.y) - r.oy) * invY;
+        Lanes4 z0 = (Lanes4(n.boxMin.z) - r.oz) * invZ;
+        Lanes4 z1 = (Lanes4(n.boxMax.z) - r.oz) * invZ;
+        Lanes4 enter = max(max(min(x0, x1), min(y0, y1)),
+                           max(min(z0, z1), Lanes4(0.0f)));
+        Lanes4 exit  = min(min(max(x0, x1), max(y0, y1)),
+                          min(max(z0, z1), tMax));
+        return le_mask(enter, exit) != 0;
+    }
+
+    void intersect_triangle4(const RayPacket& r,
+                             uint32_t         i,
+                             Lanes4&          tHit,
+                             RayHit           hits[4]) const
+    {
+        const Triangle& tri = tris_[i];
+        Lanes4 e1x(tri.e1.x), e1y(tri.e1.y), e1z(tri.e1.z);
+        Lanes4 e2x(tri.e2.x), e2y(tri.e2.y), e2z(tri.e2.z);
+
+        // p = dir x e2
+        Lanes4 px  = r.dy * e2z - r.dz * e2y;
+        Lanes4 py  = r.dz * e2x - r.dx * e2z;
+        Lanes4 pz  = r.dx * e2y - r.dy * e2x;
+        Lanes4 det = e1x * px + e1y * py + e1z * pz;
+
+        Lanes4 sx = r.ox - Lanes4(tri.v0.x);
+        Lanes4 sy = r.oy - Lanes4(tri.v0.y);
+        Lanes4 sz = r.oz - Lanes4(tri.v0.z);
+        Lanes4 uDet = sx * px + sy * py + sz * pz;
+
+        // q = s x e1
+        Lanes4 qx   = sy * e1z - sz * e1y;
+        Lanes4 qy   = sz * e1x - sx * e1z;
+        Lanes4 qz   = sx * e1y - sy * e1x;
+        Lanes4 vDet = r.dx * qx + r.dy * qy + r.dz * qz;
+        Lanes4 tDet = e2x * qx + e2y * qy + e2z * qz;
+
+        for (int lane = 0; lane < 4; lane++)
+        {
+            float d = det[lane];
+            if (std::fabs(d) < 1e-12f) continue;
+            float inv = 1.0f / d;
+            float u = uDet[lane] * inv, v = vDet[lane] * inv;
+            float t = tDet[lane] * inv;
+            if (u < 0.0f || v < 0.0f || u + v > 1.0f) continue;
+            if (t <= 0.0f || t >= hits[lane].t) continue;
+            hits[lane] = { t, i, u, v };
+        }
+        tHit = min(tHit, Lanes4(hits[0].t, hits[1].t, hits[2].t, hits[3].t));
+    }
+
+    std::vector<BvhNode>  nodes_;
+    std::vector<Triangle> tris_;
+    std::vector<uint32_t> ids_; // leaf order -> original triangle
+};
+
+// Two-level BVH for instanced geometry: one Bvh per unique mesh in its
+// local space, and a top level over the world bounds of the instances.
+// Rays that reach an instance are moved into its local space, so a mesh
+// referenced by thousands of nodes is stored and built once.
+class SceneBvh
+{
+public:
+    double BuildMs = 0.0;
+
+    void build(const PositionStreams&           positions,
+               const std::vector<DrawRange>&    ranges,
+               const std::vector<MeshInstance>& instances,
+               ThreadPool&                      pool)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        meshes_.assign(ranges.size(), Bvh{});
+        pool.parallel_for(ranges.size(),
+                          1,
+                          [&](size_t begin, size_t end)
+                          {
+                              for (size_t r = begin; r < end; r++)
+                                  meshes_[r].build(positions,
+                                                   ranges[r].first,
+                                                   ranges[r].count,
+                                                   pool);
+                          });
+
+        instances_.clear();
+        std::vector<glm::vec3> boxMin, boxMax, centroid;
+        for (const auto& inst : instances)
+        {
+            const Bvh& mesh = meshes_[inst.range];
+            if (mesh.tris_.empty()) continue;
+            glm::vec3 lo, hi;
+            transformBox(inst.transform,
+                         mesh.nodes_[0].boxMin,
+                         mesh.nodes_[0].boxMax,
+                         lo,
+                         hi);
+            boxMin.push_back(lo);
+            boxMax.push_back(hi);
+            centroid.push_back((lo + hi) * 0.5f);
+            instances_.push_back(
+                { glm::inverse(inst.transform),
+                  inst.range,
+                  ranges[inst.range].first / 3,
+                  uint32_t(&inst - instances.data()) });
+        }
+
+        size_t count = instances_.size();
+        if (count > Bvh::MAX_TRIANGLES)
+        {
+            std::cerr << "BVH: " << count << " instances exceed the 32-bit "
+                      << "node indices, ray queries skip them\n";
+            instances_.clear();
+            boxMin.clear();
+            boxMax.clear();
+            centroid.clear();
+            count = 0;
+        }
+        ids_.resize(count);
+        std::iota(ids_.begin(), ids_.end(), 0U);
+        nodes_.assign(std::max<size_t>(1, 2 * count), BvhNode{});
+        Bvh::Builder builder{
+            boxMin, boxMax, centroid, ids_, nodes_, pool, { 1 }
+        };
+        builder.build(0, 0, uint32_t(count));
+        nodes_.resize(builder.nodeCount.load());
+
+        BuildMs = std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+    }
+
+    // Top-level nodes plus the nodes of every mesh
+    size_t node_count() const
+    {
+        size_t n = nodes_.size();
+        for (const auto& mesh : meshes_)
+            n += mesh.node_count();
+        return n;
+    }
+
+    // Triangles with every instance counted
+    size_t triangle_count() const
+    {
+        size_t n = 0;
+        for (const auto& inst : instances_)
+            n += meshes_[inst.range].triangle_count();
+        return n;
+    }
+
+    // Closest hit along origin + t * dir for t in (0, tMax). The triangle
+    // indexes the soup of the instance's mesh.
+    bool intersect(const glm::vec3& origin,
+                   const glm::vec3& dir,
+                   float            tMax,
+                   RayHit&          hit) const
+    {
+        hit = RayHit{};
+        if (ids_.empty()) return false;
+        hit.t = tMax;
+
+        glm::vec3 invDir = 1.0f / dir;
+        uint32_t  stack[Bvh::STACK_SIZE];
+        int       sp   = 0;
+        uint32_t  node = 0;
+        for (;;)
+        {
+            const BvhNode& n = nodes_[node];
+            if (n.count > 0)
+            {
+                for (uint32_t i = n.leftFirst; i < n.leftFirst + n.count; i++)
+                    intersect_instance(ids_[i], origin, dir, hit);
+            }
+            else
+            {
+                uint32_t near = n.leftFirst, far = n.leftFirst + 1;
+                float    tNear =
+                    Bvh::box_distance(nodes_[near], origin, invDir, hit.t);
+                float tFar =
+                    Bvh::box_distance(nodes_[far], origin, invDir, hit.t);
+                if (tFar < tNear)
+                {
+                    std::swap(near, far);
+                    std::swap(tNear, tFar);
+                }
+                if (tNear != FLT_MAX)
+                {
+                    if (tFar != FLT_MAX) stack[sp++] = far;
+                    node = near;
+                    continue;
+                }
+            }
+            if (sp == 0) break;
+            node = stack[--sp];
+        }
+        return hit.valid();
+    }
+
+    // Closest hit on the segment from a to b
+    bool intersect_segment(const glm::vec3& a, const glm::vec3& b, RayHit& hit) const
+    {
+        glm::vec3 d   = b - a;
+        float     len = glm::length(d);
+        if (len <= 0.0f) return false;
+        bool found = intersect(a, d / len, len, hit);
+        if (found) hit.t /= len; // as a fraction of the segment
+        return found;
+    }
+
+    // Packet traversal of the top level; each instance reached is tested
+    // with the packet moved into its local space
+    void intersect4(const RayPacket& packet, RayHit hits[4]) const
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            hits[i]   = RayHit{};
+            hits[i].t = packet.tMax[i];
+        }
+        if (ids_.empty()) return;
+
+        Lanes4 invX = Lanes4(1.0f / packet.dx[0], 1.0f / packet.dx[1],
+                             1.0f / packet.dx[2], 1.0f / packet.dx[3]);
+        Lanes4 invY = Lanes4(1.0f / packet.dy[0], 1.0f / packet.dy[1],
+                             1.0f / packet.dy[2], 1.0f / packet.dy[3]);
+        Lanes4 invZ = Lanes4(1.0f / packet.dz[0], 1.0f / packet.dz[1],
+                             1.0f / packet.dz[2], 1.0f / packet.dz[3]);
+        Lanes4 tHit = packet.tMax;
+
+        uint32_t stack[Bvh::STACK_SIZE];
+        int      sp   = 0;
+        uint32_t node = 0;
+        for (;;)
+        {
+            const BvhNode& n = nodes_[node];
+            if (Bvh::packet_hits_box(n, packet, invX, invY, invZ, tHit))
+            {
+                if (n.count > 0)
+                {
+                    for (uint32_t i = n.leftFirst; i < n.leftFirst + n.count; i++)
+                        intersect_instance4(ids_[i], packet, tHit, hits);
+                }
+                else
+                {
+                    glm::vec3 extent = n.boxMax - n.boxMin;
+                    int       axis   = extent.x > extent.y
+                                           ? (extent.x > extent.z ? 0 : 2)
+                                           : (extent.y > extent.z ? 1 : 2);
+                    float     d      = axis == 0   ? packet.dx[0]
+                                       : axis == 1 ? packet.dy[0]
+                                                   : packet.dz[0];
+                    uint32_t  first  = n.leftFirst + (d < 0.0f ? 1 : 0);
+                    uint32_t  second = d < 0.0f ? n.leftFirst : n.leftFirst + 1;
+                    stack[sp++]      = second;
+                    node             = first;
+                    continue;
+                }
+            }
+            if (sp == 0) break;
+            node = stack[--sp];
+        }
+    }
+
+private:
+    struct Instance
+    {
+        glm::mat4 toLocal;
+        uint32_t  range;
+        uint64_t  firstTriangle; // of the mesh in the soup
+        uint32_t  index;         // in the instance list given to build()
+    };
+
+    void intersect_instance(uint32_t         i,
+                            const glm::vec3& origin,
+                            const glm::vec3& dir,
+                            RayHit&          hit) const
+    {
+        const Instance& inst = instances_[i];
+        // Not renormalised, so t is the same parameter in both spaces
+        glm::vec3 o = glm::vec3(inst.toLocal * glm::vec4(origin, 1.0f));
+        glm::vec3 d = glm::mat3(inst.toLocal) * dir;
+        RayHit    local;
+        if (!meshes_[inst.range].intersect(o, d, hit.t, local)) return;
+        hit          = local;
+        hit.triangle = local.triangle + inst.firstTriangle;
+        hit.instance = inst.index;
+    }
+
+    void intersect_instance4(uint32_t         i,
+                             const RayPacket& packet,
+                             Lanes4&          tHit,
+                             RayHit           hits[4]) const
+    {
+        const Instance& inst = instances_[i];
+        glm::mat3       m(inst.toLocal);
+        float           o[3][4], d[3][4];
+        for (int lane = 0; lane < 4; lane++)
+        {
+            glm::vec3 lo = glm::vec3(
+                inst.toLocal * glm::vec4(packet.ox[lane],
+                                         packet.oy[lane],
+                                         packet.oz[lane],
+                                         1.0f));
+            glm::vec3 ld = m * glm::vec3(
+                               packet.dx[lane], packet.dy[lane], packet.dz[lane]);
+            for (int a = 0; a < 3; a++)
+            {
+                o[a][lane] = lo[a];
+                d[a][lane] = ld[a];
+            }
+        }
+        auto lanes = [](const float* v)
+        { return Lanes4(v[0], v[1], v[2], v[3]); };
+        RayPacket local{ lanes(o[0]), lanes(o[1]), lanes(o[2]),
+                         lanes(d[0]), lanes(d[1]), lanes(d[2]), tHit };
+
+        RayHit localHits[4];
+        meshes_[inst.range].intersect4(local, localHits);
+        for (int lane = 0; lane < 4; lane++)
+        {
+            if (!localHits[lane].valid() || localHits[lane].t >= hits[lane].t)
+                continue;
+            hits[lane]          = localHits[lane];
+            hits[lane].triangle = localHits[lane].triangle + inst.firstTriangle;
+            hits[lane].instance = inst.index;
+        }
+        tHit = Lanes4(hits[0].t, hits[1].t, hits[2].t, hits[3].t);
+    }
+
+    std::vector<Bvh>      meshes_; // per DrawRange, local space
+    std::vector<Instance> instances_;
+    std::vector<BvhNode>  nodes_;  // top level over instances
+    std::vector<uint32_t> ids_;    // leaf order -> instances_
+};
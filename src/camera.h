@@ -2,6 +2,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <algorithm>
+#include <cmath>
 
 enum Camera_Movement
 {
@@ -75,6 +76,47 @@ public:
         }
     }
     
+    // Turns to face `point` and makes it the orbit center
+    void focus(const glm::vec3& point)
+    {
+        SceneCenter = point;
+        glm::vec3 dir = point - Position;
+        if (glm::length(dir) <= 0.0f) return;
+        set_front(glm::normalize(dir));
+    }
+
+    // Rotates the camera around SceneCenter, keeping it in view
+    void orbit(float xoffset, float yoffset)
+    {
+        glm::vec3 offset = Position - SceneCenter;
+        float     radius = glm::length(offset);
+        if (radius <= 0.0f) return;
+
+        float yaw = glm::degrees(std::atan2(offset.z, offset.x)) +
+                    xoffset * Sensitivity;
+        float pitch = glm::degrees(std::asin(
+                          glm::clamp(offset.y / radius, -1.0f, 1.0f))) -
+                      yoffset * Sensitivity;
+        pitch = glm::clamp(pitch, -89.0f, 89.0f);
+
+        offset.x = std::cos(glm::radians(yaw)) * std::cos(glm::radians(pitch));
+        offset.y = std::sin(glm::radians(pitch));
+        offset.z = std::sin(glm::radians(yaw)) * std::cos(glm::radians(pitch));
+        Position = SceneCenter + offset * radius;
+        set_front(-offset);
+    }
+
+    // Points the camera along `front`, keeping yaw/pitch in sync so mouse
+    // look continues from the new direction
+    void set_front(const glm::vec3& front)
+    {
+        glm::vec3 f = glm::normalize(front);
+        Pitch       = glm::degrees(std::asin(glm::clamp(f.y, -1.0f, 1.0f)));
+        Pitch       = glm::clamp(Pitch, -89.0f, 89.0f);
+        Yaw         = glm::degrees(std::atan2(f.z, f.x));
+        update_vectors();
+    }
+
     void process_mouse_movement(float xoffset, float yoffset)
     {
         xoffset *= Sensitivity;
@@ -0,0 +1,547 @@
+#pragma once
+#include "mesh.h"
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+// Triangles per cluster. Clusters are contiguous runs of the vertex soup
+// within one draw range and one buffer page, placed by one mesh instance,
+// so a cluster maps directly onto one DrawArrays command (baseInstance
+// selecting the transform) and never mixes materials.
+const unsigned int CLUSTER_TRIANGLES = 128;
+
+// Matches the std430 layout of `Cluster` in cull_compute.glsl
+struct Cluster
+{
+    glm::vec4    boxMin;      // xyz used, world space
+    glm::vec4    boxMax;      // xyz used, world space
+    glm::vec4    cone;        // normal cone axis (xyz) and cutoff (w)
+    unsigned int first;       // first vertex in its page
+    unsigned int count;       // vertex count
+    unsigned int batch;       // material, draws are issued per batch
+    unsigned int commandBase; // first command slot of the batch
+    unsigned int instance;    // transform in the instance buffer
+    unsigned int page;        // vertex buffer page
+    unsigned int padding[2];
+};
+
+// A run of the soup uploaded as its own vertex buffer. Pages start on
+// cluster boundaries, so no cluster or merged draw crosses one.
+struct PageSpan
+{
+    size_t first; // first vertex in the soup
+    size_t count;
+};
+
+// Cuts the soup into pages of at most `maxVertices` vertices
+std::vector<PageSpan> plan_pages(const std::vector<DrawRange>& ranges,
+                                 size_t                        maxVertices)
+{
+    size_t clusterVertices = CLUSTER_TRIANGLES * 3;
+    maxVertices            = std::max(maxVertices, clusterVertices);
+
+    std::vector<PageSpan> pages;
+    for (const DrawRange& range : ranges)
+    {
+        size_t end = range.first + range.count;
+        for (size_t first = range.first; first < end; first += clusterVertices)
+        {
+            size_t last = std::min(first + clusterVertices, end);
+            if (pages.empty() || last - pages.back().first > maxVertices)
+                pages.push_back({ first, last - first });
+            else
+                pages.back().count = last - pages.back().first;
+        }
+    }
+    return pages;
+}
+
+// Matches DrawArraysIndirectCommand in the GL spec
+struct DrawArraysCommand
+{
+    unsigned int count;
+    unsigned int instanceCount;
+    unsigned int first;
+    unsigned int baseInstance;
+};
+
+struct Frustum
+{
+    glm::vec4 planes[6]; // left, right, bottom, top, near, far
+};
+
+// Gribb/Hartmann plane extraction; planes point inwards
+Frustum extract_frustum(const glm::mat4& viewProj)
+{
+    Frustum   f{};
+    glm::vec4 row[4];
+    for (int i = 0; i < 4; i++)
+        row[i] = glm::vec4(
+            viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]);
+
+    f.planes[0] = row[3] + row[0];
+    f.planes[1] = row[3] - row[0];
+    f.planes[2] = row[3] + row[1];
+    f.planes[3] = row[3] - row[1];
+    f.planes[4] = row[3] + row[2];
+    f.planes[5] = row[3] - row[2];
+
+    for (auto& p : f.planes)
+        p = p / glm::length(glm::vec3(p));
+    return f;
+}
+
+bool box_in_frustum(const Frustum&   f,
+                    const glm::vec3& boxMin,
+                    const glm::vec3& boxMax)
+{
+    for (const auto& p : f.planes)
+    {
+        // Test the corner furthest along the plane normal
+        glm::vec3 v(p.x > 0 ? boxMax.x : boxMin.x,
+                    p.y > 0 ? boxMax.y : boxMin.y,
+                    p.z > 0 ? boxMax.z : boxMin.z);
+        if (glm::dot(glm::vec3(p), v) + p.w < 0) return false;
+    }
+    return true;
+}
+
+// True if every triangle of the cluster faces away from the camera
+bool cone_backfacing(const Cluster& c, const glm::vec3& cameraPos)
+{
+    if (c.cone.w >= 1.0f) return false; // degenerate cone, never reject
+
+    glm::vec3 boxMin(c.boxMin), boxMax(c.boxMax);
+    glm::vec3 center = (boxMin + boxMax) * 0.5f;
+    float     radius = glm::length(boxMax - center);
+    glm::vec3 toCenter = center - cameraPos;
+    return glm::dot(toCenter, glm::vec3(c.cone)) >=
+           c.cone.w * glm::length(toCenter) + radius;
+}
+
+// Bounds and normal cone of `count` soup vertices starting at `first`. The
+// caller places the cluster in its page.
+Cluster make_cluster(const PositionStreams& positions,
+                     size_t                 first,
+                     size_t                 count,
+                     unsigned int           batch)
+{
+    Cluster c{};
+    c.count = static_cast<unsigned int>(count);
+    c.batch = batch;
+
+    glm::vec3 boxMin, boxMax, axis(0.0f);
+    stream_bounds(positions, first, count, boxMin, boxMax);
+
+    std::vector<glm::vec3> faceNormals;
+    faceNormals.reserve(count / 3);
+    for (size_t t = first; t + 2 < first + count; t += 3)
+    {
+        glm::vec3 p0 = positions[t], p1 = positions[t + 1],
+                  p2 = positions[t + 2];
+
+        glm::vec3 n   = glm::cross(p1 - p0, p2 - p0);
+        float     len = glm::length(n);
+        if (len > 0.0f)
+        {
+            faceNormals.push_back(n / len);
+            axis += n / len;
+        }
+    }
+
+    c.boxMin = glm::vec4(boxMin, 0.0f);
+    c.boxMax = glm::vec4(boxMax, 0.0f);
+
+    // Cone cutoff is the sine of the widest normal deviation from the
+    // axis; anything past 90 degrees can never be rejected.
+    float axisLen = glm::length(axis);
+    float minDot  = axisLen > 0.0f ? 1.0f : -1.0f;
+    if (axisLen > 0.0f)
+    {
+        axis /= axisLen;
+        for (const auto& n : faceNormals)
+            minDot = std::min(minDot, glm::dot(axis, n));
+    }
+    c.cone = minDot <= 0.1f ? glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)
+                            : glm::vec4(axis, std::sqrt(1.0f - minDot * minDot));
+    return c;
+}
+
+// Moves a local-space cluster to where `transform` places it. The cone is
+// kept for rotations and uniform scales only.
+Cluster place_cluster(const Cluster&   local,
+                      const glm::mat4& transform,
+                      unsigned int     instance)
+{
+    Cluster   c = local;
+    glm::vec3 boxMin, boxMax;
+    transformBox(transform,
+                 glm::vec3(local.boxMin),
+                 glm::vec3(local.boxMax),
+                 boxMin,
+                 boxMax);
+    c.boxMin   = glm::vec4(boxMin, 0.0f);
+    c.boxMax   = glm::vec4(boxMax, 0.0f);
+    c.instance = instance;
+
+    if (c.cone.w < 1.0f)
+    {
+        glm::vec3 x(transform[0]), y(transform[1]), z(transform[2]);
+        float     sx = glm::length(x), sy = glm::length(y), sz = glm::length(z);
+        bool      similar = std::fabs(sx - sy) <= 1e-4f * sx &&
+                       std::fabs(sx - sz) <= 1e-4f * sx &&
+                       glm::dot(glm::cross(x, y), z) > 0.0f;
+        c.cone = similar ? glm::vec4(glm::normalize(glm::mat3(transform) *
+                                                    glm::vec3(local.cone)),
+                                     local.cone.w)
+                         : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    }
+    return c;
+}
+
+// Splits each draw range of a triangle soup into fixed-size clusters in
+// local space, then places a copy for every instance of the range, batched
+// by material. `pages` come from plan_pages on the same ranges.
+std::vector<Cluster> build_clusters(const PositionStreams&           positions,
+                                    const std::vector<DrawRange>&    ranges,
+                                    const std::vector<MeshInstance>& instances,
+                                    const std::vector<PageSpan>&     pages)
+{
+    std::vector<std::vector<Cluster>> local(ranges.size());
+    size_t                            clusterVertices = CLUSTER_TRIANGLES * 3;
+    size_t                            page            = 0;
+    for (size_t r = 0; r < ranges.size(); r++)
+    {
+        const DrawRange& range = ranges[r];
+        size_t           end   = range.first + range.count;
+        for (size_t first = range.first; first < end; first += clusterVertices)
+        {
+            while (first >= pages[page].first + pages[page].count) page++;
+            Cluster c = make_cluster(positions,
+                                     first,
+                                     std::min(clusterVertices, end - first),
+                                     range.material);
+            c.first   = static_cast<unsigned int>(first - pages[page].first);
+            c.page    = static_cast<unsigned int>(page);
+            local[r].push_back(c);
+        }
+    }
+
+    // An instance's clusters stay adjacent, so the CPU path can merge them
+    std::vector<Cluster> clusters;
+    for (size_t i = 0; i < instances.size(); i++)
+        for (const Cluster& c : local[instances[i].range])
+            clusters.push_back(place_cluster(
+                c, instances[i].transform, static_cast<unsigned int>(i)));
+    return clusters;
+}
+
+// Culls clusters of the paged vertex soup and issues the surviving draws,
+// one batch (page and material) at a time. The GPU path runs
+// cull_compute.glsl, which compacts each batch's commands into its own
+// slice of an indirect buffer drawn with glMultiDrawArraysIndirectCount,
+// so CPU cost does not depend on scene size.
+// Without indirect-count support the compute pass writes every command and
+// zeroes the instance count of culled ones. Without compute shaders culling
+// falls back to the CPU, with one draw per run of adjacent visible clusters
+// of an instance. baseInstance picks each draw's transform on every path.
+class ClusterCuller
+{
+public:
+    enum Path
+    {
+        GPU_COUNT,   // compute + compacted multi-draw indirect count
+        GPU_INPLACE, // compute + uncompacted multi-draw indirect
+        CPU,
+        NONE,
+    };
+
+    Path         ActivePath      = NONE;
+    bool         ConeCulling     = false;
+    unsigned int VisibleClusters = 0; // last CPU result, 0 on GPU paths
+
+    // Optional CPU path test run on frustum survivors, true when hidden
+    std::function<bool(const Cluster&)> Occluded;
+    double OcclusionTestMs   = 0.0;
+    size_t TestedTriangles   = 0; // in the frustum, last CPU result
+    size_t OccludedTriangles = 0;
+
+    void init(const std::vector<Cluster>& clusters,
+              unsigned int                computeProgram,
+              bool                        allowGpu,
+              bool                        allowCpu)
+    {
+        clusters_       = clusters;
+        computeProgram_ = computeProgram;
+
+        // Group clusters by page, then material, so every batch owns a
+        // contiguous slice of the command buffer and pages are bound once.
+        // From here on `batch` is the batch index, not the material.
+        std::stable_sort(clusters_.begin(),
+                         clusters_.end(),
+                         [](const Cluster& a, const Cluster& b)
+                         {
+                             return a.page != b.page ? a.page < b.page
+                                                     : a.batch < b.batch;
+                         });
+        batches_.clear();
+        for (size_t i = 0; i < clusters_.size(); i++)
+        {
+            Cluster& c = clusters_[i];
+            if (batches_.empty() || batches_.back().page != c.page ||
+                batches_.back().material != c.batch)
+            {
+                batches_.push_back(Batch{});
+                batches_.back().offset   = i;
+                batches_.back().page     = c.page;
+                batches_.back().material = c.batch;
+            }
+            batches_.back().size++;
+            c.batch       = static_cast<unsigned int>(batches_.size() - 1);
+            c.commandBase = static_cast<unsigned int>(batches_.back().offset);
+        }
+
+        bool hasCompute = GLAD_GL_VERSION_4_3 && computeProgram != 0;
+        bool hasCount   = GLAD_GL_VERSION_4_6 ||
+                        GLAD_GL_ARB_indirect_parameters;
+
+        if (allowGpu && hasCompute)
+            ActivePath = hasCount ? GPU_COUNT : GPU_INPLACE;
+        else if (allowCpu)
+            ActivePath = CPU;
+        else
+            ActivePath = NONE;
+
+        if (ActivePath == GPU_COUNT || ActivePath == GPU_INPLACE)
+        {
+            GLsizeiptr clusterBytes = clusters_.size() * sizeof(Cluster);
+            GLsizeiptr commandBytes = clusters_.size() *
+                                      sizeof(DrawArraysCommand);
+
+            glGenBuffers(1, &clusterSSBO_);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterSSBO_);
+            glBufferData(GL_SHADER_STORAGE_BUFFER,
+                         clusterBytes,
+                         clusters_.data(),
+                         GL_STATIC_DRAW);
+
+            glGenBuffers(1, &commandBuffer_);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer_);
+            glBufferData(
+                GL_SHADER_STORAGE_BUFFER, commandBytes, nullptr, GL_DYNAMIC_COPY);
+
+            glGenBuffers(1, &countBuffer_);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer_);
+            glBufferData(GL_SHADER_STORAGE_BUFFER,
+                         std::max<size_t>(batches_.size(), 1) *
+                             sizeof(unsigned int),
+                         nullptr,
+                         GL_DYNAMIC_COPY);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        }
+        else
+        {
+            // The unculled path draws straight from these lists
+            for (auto& b : batches_)
+                for (size_t i = b.offset; i < b.offset + b.size; i++)
+                    b.add(clusters_[i]);
+        }
+
+        const char* pathNames[] = {
+            "GPU (indirect count)", "GPU (indirect)", "CPU", "off"
+        };
+        std::cout << "Cluster culling: " << pathNames[ActivePath] << ", "
+                  << clusters_.size() << " clusters in " << batches_.size()
+                  << " batches" << '\n';
+    }
+
+    const char* path_name() const
+    {
+        const char* names[] = { "GPU", "GPU (no count)", "CPU", "Off" };
+        return names[ActivePath];
+    }
+
+    size_t cluster_count() const { return clusters_.size(); }
+
+    size_t batch_count() const { return batches_.size(); }
+
+    unsigned int batch_page(size_t batch) const { return batches_[batch].page; }
+
+    unsigned int batch_material(size_t batch) const
+    {
+        return batches_[batch].material;
+    }
+
+    // Runs the culling pass for this frame. Must be called before draw().
+    void cull(const glm::mat4& viewProj, const glm::vec3& cameraPos)
+    {
+        Frustum frustum = extract_frustum(viewProj);
+
+        if (ActivePath == CPU)
+        {
+            VisibleClusters = 0;
+            candidates_.clear();
+            for (auto& b : batches_)
+            {
+                b.draws.clear();
+                for (size_t i = b.offset; i < b.offset + b.size; i++)
+                {
+                    const Cluster& c = clusters_[i];
+                    if (!box_in_frustum(
+                            frustum, glm::vec3(c.boxMin), glm::vec3(c.boxMax)))
+                        continue;
+                    if (ConeCulling && cone_backfacing(c, cameraPos)) continue;
+                    candidates_.push_back(i);
+                }
+            }
+
+            // Occlusion tests run separately so their cost can be timed
+            auto start        = std::chrono::steady_clock::now();
+            TestedTriangles   = 0;
+            OccludedTriangles = 0;
+            for (size_t i : candidates_)
+            {
+                const Cluster& c = clusters_[i];
+                TestedTriangles += c.count / 3;
+                if (Occluded && Occluded(c))
+                {
+                    OccludedTriangles += c.count / 3;
+                    continue;
+                }
+                batches_[c.batch].add(c);
+                VisibleClusters++;
+            }
+            OcclusionTestMs = std::chrono::duration<double, std::milli>(
+                                  std::chrono::steady_clock::now() - start)
+                                  .count();
+            return;
+        }
+        if (ActivePath == NONE) return;
+
+        std::vector<unsigned int> zeros(batches_.size(), 0);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer_);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER,
+                        0,
+                        zeros.size() * sizeof(unsigned int),
+                        zeros.data());
+
+        glUseProgram(computeProgram_);
+        glUniform4fv(glGetUniformLocation(computeProgram_, "frustumPlanes"),
+                     6,
+                     &frustum.planes[0][0]);
+        glUniform3fv(
+            glGetUniformLocation(computeProgram_, "cameraPos"), 1, &cameraPos[0]);
+        glUniform1ui(glGetUniformLocation(computeProgram_, "clusterCount"),
+                     static_cast<GLuint>(clusters_.size()));
+        glUniform1i(glGetUniformLocation(computeProgram_, "useConeCulling"),
+                    ConeCulling ? 1 : 0);
+        glUniform1i(glGetUniformLocation(computeProgram_, "compact"),
+                    ActivePath == GPU_COUNT ? 1 : 0);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, clusterSSBO_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commandBuffer_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, countBuffer_);
+
+        GLuint groups = static_cast<GLuint>((clusters_.size() + 63) / 64);
+        glDispatchCompute(groups, 1, 1);
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+    }
+
+    // Draws every batch that survived the last cull() with the current
+    // program, calling bind_page(page) whenever the page changes
+    template <class BindPage>
+    void draw(BindPage bind_page) const
+    {
+        for (size_t b = 0; b < batches_.size(); b++)
+        {
+            if (b == 0 || batches_[b].page != batches_[b - 1].page)
+                bind_page(batches_[b].page);
+            draw_batch(b);
+        }
+    }
+
+    // Draws one batch with its page bound, so the caller can bind its
+    // material first
+    void draw_batch(size_t batch) const
+    {
+        const Batch& b = batches_[batch];
+        if (b.size == 0) return;
+
+        const void* commands = reinterpret_cast<const void*>(
+            b.offset * sizeof(DrawArraysCommand));
+        GLintptr countOffset = static_cast<GLintptr>(batch *
+                                                     sizeof(unsigned int));
+        GLsizei  maxDraws    = static_cast<GLsizei>(b.size);
+
+        switch (ActivePath)
+        {
+        case GPU_COUNT:
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer_);
+            glBindBuffer(GL_PARAMETER_BUFFER, countBuffer_);
+            if (GLAD_GL_VERSION_4_6)
+                glMultiDrawArraysIndirectCount(
+                    GL_TRIANGLES, commands, countOffset, maxDraws, 0);
+            else
+                glMultiDrawArraysIndirectCountARB(
+                    GL_TRIANGLES, commands, countOffset, maxDraws, 0);
+            glBindBuffer(GL_PARAMETER_BUFFER, 0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            break;
+        case GPU_INPLACE:
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer_);
+            glMultiDrawArraysIndirect(GL_TRIANGLES, commands, maxDraws, 0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            break;
+        case CPU:
+        case NONE:
+            for (const auto& d : b.draws)
+                glDrawArraysInstancedBaseInstance(
+                    GL_TRIANGLES, d.first, d.count, 1, d.instance);
+            break;
+        }
+    }
+
+private:
+    struct Draw
+    {
+        GLint   first;
+        GLsizei count;
+        GLuint  instance;
+    };
+
+    struct Batch
+    {
+        size_t            offset   = 0; // first cluster / command slot
+        size_t            size     = 0;
+        unsigned int      page     = 0;
+        unsigned int      material = 0;
+        std::vector<Draw> draws; // CPU path draw list
+
+        // Extends the last draw when the cluster continues it
+        void add(const Cluster& c)
+        {
+            if (!draws.empty() && draws.back().instance == c.instance &&
+                GLuint(draws.back().first + draws.back().count) == c.first)
+                draws.back().count += static_cast<GLsizei>(c.count);
+            else
+                draws.push_back({ static_cast<GLint>(c.first),
+                                  static_cast<GLsizei>(c.count),
+                                  c.instance });
+        }
+    };
+
+    std::vector<Cluster> clusters_;
+    std::vector<Batch>   batches_;
+    std::vector<size_t>  candidates_; // CPU path frustum survivors
+    unsigned int         computeProgram_ = 0;
+    unsigned int         clusterSSBO_    = 0;
+    unsigned int         commandBuffer_  = 0;
+    unsigned int         countBuffer_    = 0;
+};
@@ -0,0 +1,507 @@
+#pragma once
+#include "frame_export.h"
+#include "options.h"
+#include "thread_pool.h"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Export split across worker processes on one machine. The coordinator
+// re-runs the executable with --worker=SOCKET; each worker loads the model
+// (from the mesh cache when possible) and then pulls one work item at a
+// time over a Unix socket, so a slow worker simply takes fewer items.
+//
+// Protocol, one line per message:
+//   worker:      READY            asks for an item
+//   coordinator: RENDER f t       frame f, tile t
+//   coordinator: EXIT             no work left
+//   worker:      FINISHED ms n    every file written, ms busy over n items
+// Items count as done only at FINISHED, since a worker writes its files
+// asynchronously; the items of a worker that disconnects before that are
+// queued again.
+
+struct WorkItem
+{
+    uint32_t frame = 0;
+    uint32_t tile  = 0;
+};
+
+// Rows per horizontal strip; the last strip may extend below the frame
+inline uint32_t tile_height(uint32_t height, uint32_t tiles)
+{
+    return (height + tiles - 1) / tiles;
+}
+
+// Applied after the projection, stretches strip `tile` (counted from the
+// top) to the whole viewport
+inline glm::mat4 tile_projection(uint32_t height,
+                                 uint32_t tileHeight,
+                                 uint32_t tile)
+{
+    float     top    = 1.0f - 2.0f * float(tile * tileHeight) / float(height);
+    float     bottom = top - 2.0f * float(tileHeight) / float(height);
+    glm::mat4 m(1.0f);
+    m[1][1] = 2.0f / (top - bottom);
+    m[3][1] = -(top + bottom) / (top - bottom);
+    return m;
+}
+
+// Window coordinates of the strip's bottom-left pixel within the frame
+inline glm::vec2 tile_offset(uint32_t height,
+                             uint32_t tileHeight,
+                             uint32_t tile)
+{
+    return { 0.0f, float(height) - float((tile + 1) * tileHeight) };
+}
+
+inline std::string tile_file_name(uint32_t frame, uint32_t tile)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), ".tile_%05u_%03u", frame, tile);
+    return name;
+}
+
+inline std::string frame_file_name(uint32_t frame)
+{
+    char name[16];
+    std::snprintf(name, sizeof(name), "frame_%05u", frame);
+    return name;
+}
+
+namespace detail
+{
+    // Newline-delimited messages over a stream socket
+    class LineChannel
+    {
+    public:
+        explicit LineChannel(int fd = -1) : fd_(fd) {}
+
+        int fd() const { return fd_; }
+
+        bool send(const std::string& line) const
+        {
+            std::string msg = line + '\n';
+            size_t      off = 0;
+            while (off < msg.size())
+            {
+                ssize_t n = ::send(
+                    fd_, msg.data() + off, msg.size() - off, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return false;
+                off += size_t(n);
+            }
+            return true;
+        }
+
+        // One read(); false once the peer has closed the socket
+        bool fill()
+        {
+            char    buf[256];
+            ssize_t n;
+            do
+                n = ::read(fd_, buf, sizeof(buf));
+            while (n < 0 && errno == EINTR);
+            if (n <= 0) return false;
+            buffer_.append(buf, size_t(n));
+            return true;
+        }
+
+        // Next complete line from what has been read so far
+        bool next(std::string& line)
+        {
+            size_t end = buffer_.find('\n');
+            if (end == std::string::npos) return false;
+            line = buffer_.substr(0, end);
+            buffer_.erase(0, end + 1);
+            return true;
+        }
+
+        // Blocks until a line arrives
+        bool receive(std::string& line)
+        {
+            while (!next(line))
+                if (!fill()) return false;
+            return true;
+        }
+
+    private:
+        int         fd_;
+        std::string buffer_;
+    };
+
+    inline sockaddr_un socket_address(const std::string& path)
+    {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+        return addr;
+    }
+} // namespace detail
+
+// Worker side. `render(item)` draws one item and queues its output,
+// `finish()` waits until every output is written. Returns 0 once the
+// coordinator has no more work.
+template <class RenderFn, class FinishFn>
+int run_worker(const std::string& socketPath, RenderFn render, FinishFn finish)
+{
+    int         fd   = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr = detail::socket_address(socketPath);
+    if (fd < 0 ||
+        connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+    {
+        std::cerr << "Worker failed to connect to " << socketPath << '\n';
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+
+    detail::LineChannel channel(fd);
+    double              busyMs = 0.0;
+    size_t              items  = 0;
+    bool                exited = false;
+    std::string         line;
+    channel.send("READY");
+    while (channel.receive(line))
+    {
+        WorkItem item;
+        int      fields =
+            std::sscanf(line.c_str(), "RENDER %u %u", &item.frame, &item.tile);
+        if (fields != 2)
+        {
+            exited = line == "EXIT";
+            break;
+        }
+        auto start = std::chrono::steady_clock::now();
+        render(item);
+        busyMs += std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+        items++;
+        if (!channel.send("READY")) break;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    finish();
+    busyMs += std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+    if (exited)
+        exited = channel.send("FINISHED " + std::to_string(busyMs) + " " +
+                              std::to_string(items));
+    close(fd);
+    return exited ? 0 : -1;
+}
+
+// Coordinator side: spawns `opts.workers` copies of this executable with
+// `args` (the original command line), hands out every frame and tile of
+// the export, replaces workers that die, stitches tiles into frames and
+// reports how well the work scaled.
+inline int run_coordinator(const Options&                  opts,
+                           const std::vector<std::string>& args,
+                           ThreadPool&                     pool)
+{
+    namespace fs = std::filesystem;
+    using Clock  = std::chrono::steady_clock;
+
+    uint32_t    frames     = uint32_t(opts.exportFrames);
+    uint32_t    tiles      = std::min(opts.exportTiles, opts.exportHeight);
+    uint32_t    tileHeight = tile_height(opts.exportHeight, tiles);
+    std::string socketPath =
+        (fs::temp_directory_path() /
+         ("rasterizer-" + std::to_string(getpid()) + ".sock"))
+            .string();
+
+    int         listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr     = detail::socket_address(socketPath);
+    unlink(socketPath.c_str());
+    if (listenFd < 0 ||
+        bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) !=
+            0 ||
+        listen(listenFd, int(opts.workers)) != 0)
+    {
+        std::cerr << "Failed to listen on " << socketPath << '\n';
+        if (listenFd >= 0) close(listenFd);
+        return -1;
+    }
+
+    // Workers get the same command line, minus --workers
+    std::vector<std::string> workerArgs;
+    for (const auto& arg : args)
+        if (arg.compare(0, 10, "--workers=") != 0) workerArgs.push_back(arg);
+    workerArgs.push_back("--worker=" + socketPath);
+
+    // Built before forking: the pool and driver threads may hold the
+    // allocator lock, so the child must not allocate before execv
+    std::vector<char*> workerArgv;
+    for (auto& arg : workerArgs)
+        workerArgv.push_back(const_cast<char*>(arg.c_str()));
+    workerArgv.push_back(nullptr);
+
+    std::vector<pid_t> children;
+    auto               spawn = [&]
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            // Keep errors, drop the load report of every worker
+            int null = open("/dev/null", O_WRONLY);
+            if (null >= 0) dup2(null, STDOUT_FILENO);
+            execv("/proc/self/exe", workerArgv.data());
+            _exit(127);
+        }
+        if (pid > 0) children.push_back(pid);
+        return pid > 0;
+    };
+
+    struct Worker
+    {
+        detail::LineChannel   channel;
+        std::vector<WorkItem> assigned; // not yet confirmed by FINISHED
+    };
+    std::vector<Worker>  workers;
+    std::vector<std::pair<double, size_t>> finished; // busy ms, items
+    std::deque<WorkItem> queue;
+    for (uint32_t f = 0; f < frames; f++)
+        for (uint32_t t = 0; t < tiles; t++)
+            queue.push_back({ f, t });
+    size_t total = queue.size(), done = 0;
+
+    std::cout << "Exporting " << frames << " frames at " << opts.exportWidth
+              << "x" << opts.exportHeight;
+    if (tiles > 1) std::cout << " in " << tiles << " strips";
+    std::cout << " with " << opts.workers << " workers\n";
+
+    auto   begin       = Clock::now();
+    size_t respawns    = 0;
+    double firstReady  = -1.0;
+    double lastDone    = 0.0; // last FINISHED, seconds from begin
+    auto   last        = begin;
+    bool   failed      = false;
+    for (size_t i = 0; i < opts.workers; i++)
+        spawn();
+
+    while (done < total)
+    {
+        std::vector<pollfd> fds{ { listenFd, POLLIN, 0 } };
+        for (auto& w : workers)
+            fds.push_back({ w.channel.fd(), POLLIN, 0 });
+        if (poll(fds.data(), fds.size(), 200) < 0 && errno != EINTR)
+        {
+            std::cerr << "Failed to poll the workers with " << total - done
+                      << " items left\n";
+            failed = true;
+            break;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0)
+            {
+                workers.emplace_back();
+                workers.back().channel = detail::LineChannel(fd);
+            }
+        }
+
+        for (size_t i = 1; i < fds.size(); i++)
+        {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            Worker& w    = workers[i - 1];
+            bool    open = w.channel.fill();
+
+            std::string line;
+            while (open && w.channel.next(line))
+            {
+                double busyMs;
+                size_t items;
+                if (line == "READY")
+                {
+                    if (firstReady < 0)
+                        firstReady = std::chrono::duration<double>(
+                                         Clock::now() - begin)
+                                         .count();
+                    if (queue.empty())
+                    {
+                        open = w.channel.send("EXIT");
+                        continue;
+                    }
+                    WorkItem item = queue.front();
+                    queue.pop_front();
+                    w.assigned.push_back(item);
+                    open = w.channel.send("RENDER " +
+                                          std::to_string(item.frame) + " " +
+                                          std::to_string(item.tile));
+                }
+                else if (std::sscanf(line.c_str(),
+                                     "FINISHED %lf %zu",
+                                     &busyMs,
+                                     &items) == 2)
+                {
+                    done += w.assigned.size();
+                    w.assigned.clear();
+                    finished.push_back({ busyMs, items });
+                    lastDone = std::chrono::duration<double>(Clock::now() -
+                                                             begin)
+                                   .count();
+                }
+            }
+            if (!open)
+            {
+                // Lost before confirming its files: hand them out again
+                queue.insert(queue.end(), w.assigned.begin(), w.assigned.end());
+                w.assigned.clear();
+                close(w.channel.fd());
+                w.channel = detail::LineChannel(-1);
+            }
+        }
+        workers.erase(std::remove_if(workers.begin(),
+                                     workers.end(),
+                                     [](const Worker& w)
+                                     { return w.channel.fd() < 0; }),
+                      workers.end());
+
+        // Replace workers that exited abnormally while work is left
+        int   status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+        {
+            children.erase(
+                std::remove(children.begin(), children.end(), pid),
+                children.end());
+            bool clean = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            if (!clean && done < total)
+            {
+                std::cerr << "Worker " << pid << " failed, ";
+                if (respawns < opts.workers && spawn())
+                {
+                    std::cerr << "starting another\n";
+                    respawns++;
+                }
+                else
+                {
+                    std::cerr << "not replacing it\n";
+                }
+            }
+        }
+        if (children.empty() && done < total)
+        {
+            std::cerr << "All workers exited with " << total - done
+                      << " items left\n";
+            failed = true;
+            break;
+        }
+
+        auto now = Clock::now();
+        if (std::chrono::duration<double>(now - last).count() >= 1.0)
+        {
+            std::cout << "  " << total - queue.size() << "/" << total
+                      << " items handed out, " << done << " written, "
+                      << workers.size() << " workers connected\n";
+            last = now;
+        }
+    }
+
+    // Idle workers still starting up are not needed any more
+    for (pid_t child : children)
+        kill(child, SIGTERM);
+    for (pid_t child : children)
+        waitpid(child, nullptr, 0);
+    for (auto& w : workers)
+        close(w.channel.fd());
+    close(listenFd);
+    unlink(socketPath.c_str());
+    if (failed || done < total) return -1;
+
+    // Rendering runs from the first worker ready to the last confirmed
+    // item, so worker startup and model loading are not counted
+    double renderSeconds = firstReady >= 0.0 ? lastDone - firstReady : 0.0;
+
+    // Stitch strips into frames; the last strip is cropped to the frame
+    if (tiles > 1)
+    {
+        ImageFormat format = opts.exportQoi ? ImageFormat::QOI
+                                            : ImageFormat::PNG;
+        size_t      row    = size_t(opts.exportWidth) * 4;
+        pool.parallel_for(
+            frames,
+            1,
+            [&](size_t firstFrame, size_t lastFrame)
+            {
+                std::vector<uint8_t> image(row * opts.exportHeight);
+                std::vector<char>    strip(row * tileHeight);
+                for (size_t f = firstFrame; f < lastFrame; f++)
+                {
+                    for (uint32_t t = 0; t < tiles; t++)
+                    {
+                        fs::path tilePath =
+                            fs::path(opts.exportDir) /
+                            (tile_file_name(uint32_t(f), t) +
+                             image_extension(ImageFormat::RAW));
+                        std::ifstream in(tilePath, std::ios::binary);
+                        in.read(strip.data(), std::streamsize(strip.size()));
+                        if (!in)
+                            std::cerr << "Missing tile " << tilePath << '\n';
+                        in.close();
+
+                        size_t y    = size_t(t) * tileHeight;
+                        size_t rows = std::min<size_t>(
+                            tileHeight, opts.exportHeight - y);
+                        std::copy(strip.begin(),
+                                  strip.begin() + std::ptrdiff_t(rows * row),
+                                  image.begin() + std::ptrdiff_t(y * row));
+                        std::error_code ec;
+                        fs::remove(tilePath, ec);
+                    }
+                    std::string name = frame_file_name(uint32_t(f)) +
+                                       image_extension(format);
+                    write_image_file(
+                        (fs::path(opts.exportDir) / name).string(),
+                        format,
+                        image.data(),
+                        opts.exportWidth,
+                        opts.exportHeight);
+                }
+            });
+    }
+    double seconds =
+        std::chrono::duration<double>(Clock::now() - begin).count();
+
+    double busyMs = 0.0;
+    for (size_t i = 0; i < finished.size(); i++)
+    {
+        busyMs += finished[i].first;
+        std::cout << "  worker " << i << ": " << finished[i].second
+                  << " items, busy " << std::fixed << std::setprecision(2)
+                  << finished[i].first / 1000.0 << " s\n";
+    }
+    // Busy time is rendering and writing only. Without a timed 1-worker
+    // run this is utilisation, not speedup: it ignores contention.
+    double busyWorkers =
+        renderSeconds > 0.0 ? busyMs / 1000.0 / renderSeconds : 0.0;
+    std::cout << "Exported " << frames << " frames in " << std::setprecision(2)
+              << seconds << " s (" << std::setprecision(1)
+              << frames / seconds << " fps, startup until the first worker "
+              << "was ready " << std::setprecision(2) << firstReady << " s, "
+              << respawns << " restarts)\n"
+              << "Rendering " << renderSeconds << " s, on average "
+              << busyWorkers << " of " << opts.workers
+              << " workers busy, utilisation " << std::setprecision(0)
+              << 100.0 * busyWorkers / double(opts.workers) << "%\n";
+    return 0;
+}
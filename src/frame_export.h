@@ -0,0 +1,466 @@
+#pragma once
+#include "thread_pool.h"
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <stb_image_write.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Offline rendering of a camera path to an image sequence
+
+enum class ImageFormat : std::uint8_t
+{
+    PNG,
+    QOI,
+    RAW, // top-down RGBA8 without a header, for tiles assembled later
+};
+
+inline const char* image_extension(ImageFormat format)
+{
+    switch (format)
+    {
+    case ImageFormat::PNG: return ".png";
+    case ImageFormat::QOI: return ".qoi";
+    default: return ".rgba";
+    }
+}
+
+struct CameraKey
+{
+    glm::vec3 position;
+    glm::vec3 target;
+};
+
+// Reads one key per line as "px py pz tx ty tz"; '#' starts a comment
+inline bool load_camera_path(const std::string&      path,
+                             std::vector<CameraKey>& keys)
+{
+    std::ifstream f(path);
+    if (!f)
+    {
+        std::cerr << "Failed to open camera path " << path << '\n';
+        return false;
+    }
+    std::string line;
+    while (std::getline(f, line))
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream in(line);
+        CameraKey          k;
+        if (in >> k.position.x >> k.position.y >> k.position.z >> k.target.x >>
+            k.target.y >> k.target.z)
+            keys.push_back(k);
+    }
+    if (keys.size() < 2)
+    {
+        std::cerr << "Camera path needs at least two keys\n";
+        return false;
+    }
+    return true;
+}
+
+// Catmull-Rom through the keys, t in [0, 1] spanning first to last key
+inline CameraKey sample_camera_path(const std::vector<CameraKey>& keys, float t)
+{
+    float  s   = std::clamp(t, 0.0f, 1.0f) * float(keys.size() - 1);
+    size_t i   = std::min(size_t(s), keys.size() - 2);
+    float  u   = s - float(i);
+    auto   key = [&](ptrdiff_t k)
+    {
+        ptrdiff_t last = ptrdiff_t(keys.size()) - 1;
+        return keys[size_t(std::clamp<ptrdiff_t>(k, 0, last))];
+    };
+    auto spline = [u](const glm::vec3& p0,
+                      const glm::vec3& p1,
+                      const glm::vec3& p2,
+                      const glm::vec3& p3)
+    {
+        return 0.5f * (2.0f * p1 + (p2 - p0) * u +
+                       (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * u * u +
+                       (3.0f * p1 - p0 - 3.0f * p2 + p3) * u * u * u);
+    };
+
+    ptrdiff_t k = ptrdiff_t(i);
+    return { spline(key(k - 1).position,
+                    key(k).position,
+                    key(k + 1).position,
+                    key(k + 2).position),
+             spline(key(k - 1).target,
+                    key(k).target,
+                    key(k + 1).target,
+                    key(k + 2).target) };
+}
+
+// View `frame` of `frames` along `path`, or of a full turn around `center`
+// starting from `start` when the path is empty. The last orbit frame stops
+// one step short of the first.
+inline CameraKey export_camera_key(const std::vector<CameraKey>& path,
+                                   const glm::vec3&              center,
+                                   const glm::vec3&              start,
+                                   size_t                        frame,
+                                   size_t                        frames)
+{
+    if (!path.empty())
+    {
+        float t = frames > 1 ? float(frame) / float(frames - 1) : 0.0f;
+        return sample_camera_path(path, t);
+    }
+    glm::vec3 offset = start - center;
+    float     radius = std::hypot(offset.x, offset.z);
+    float     angle  = std::atan2(offset.z, offset.x) +
+                       glm::radians(360.0f) * float(frame) / float(frames);
+    return { center + glm::vec3(std::cos(angle) * radius,
+                                offset.y,
+                                std::sin(angle) * radius),
+             center };
+}
+
+// QOI encoder for top-down RGBA8 pixels (https://qoiformat.org)
+inline std::vector<uint8_t> encode_qoi(const uint8_t* rgba,
+                                       uint32_t       w,
+                                       uint32_t       h)
+{
+    std::vector<uint8_t> out;
+    out.reserve(size_t(w) * h * 2 + 22);
+    auto put32 = [&](uint32_t v)
+    {
+        for (int s = 24; s >= 0; s -= 8)
+            out.push_back(uint8_t(v >> s));
+    };
+    out.insert(out.end(), { 'q', 'o', 'i', 'f' });
+    put32(w);
+    put32(h);
+    out.push_back(4); // RGBA
+    out.push_back(0); // sRGB with linear alpha
+
+    uint8_t index[64][4] = {};
+    uint8_t prev[4]      = { 0, 0, 0, 255 };
+    int     run          = 0;
+    size_t  count        = size_t(w) * h;
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint8_t* px = rgba + i * 4;
+        if (std::equal(px, px + 4, prev))
+        {
+            if (++run == 62 || i + 1 == count)
+            {
+                out.push_back(uint8_t(0xC0 | (run - 1))); // QOI_OP_RUN
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0)
+        {
+            out.push_back(uint8_t(0xC0 | (run - 1)));
+            run = 0;
+        }
+
+        int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+        if (std::equal(px, px + 4, index[hash]))
+        {
+            out.push_back(uint8_t(hash)); // QOI_OP_INDEX
+        }
+        else
+        {
+            std::copy(px, px + 4, index[hash]);
+            if (px[3] == prev[3])
+            {
+                int8_t dr = int8_t(px[0] - prev[0]);
+                int8_t dg = int8_t(px[1] - prev[1]);
+                int8_t db = int8_t(px[2] - prev[2]);
+                int8_t rg = int8_t(dr - dg), bg = int8_t(db - dg);
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 &&
+                    db <= 1) // QOI_OP_DIFF
+                    out.push_back(uint8_t(0x40 | (dr + 2) << 4 | (dg + 2) << 2 |
+                                          (db + 2)));
+                else if (dg >= -32 && dg <= 31 && rg >= -8 && rg <= 7 &&
+                         bg >= -8 && bg <= 7) // QOI_OP_LUMA
+                {
+                    out.push_back(uint8_t(0x80 | (dg + 32)));
+                    out.push_back(uint8_t((rg + 8) << 4 | (bg + 8)));
+                }
+                else // QOI_OP_RGB
+                    out.insert(out.end(), { 0xFE, px[0], px[1], px[2] });
+            }
+            else // QOI_OP_RGBA
+                out.insert(out.end(), { 0xFF, px[0], px[1], px[2], px[3] });
+        }
+        std::copy(px, px + 4, prev);
+    }
+    out.insert(out.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+    return out;
+}
+
+// Writes top-down RGBA8 pixels; returns false and reports on failure
+inline bool write_image_file(const std::string& path,
+                             ImageFormat        format,
+                             const uint8_t*     pixels,
+                             uint32_t           width,
+                             uint32_t           height)
+{
+    bool ok;
+    if (format == ImageFormat::PNG)
+    {
+        ok = stbi_write_png(path.c_str(),
+                            int(width),
+                            int(height),
+                            4,
+                            pixels,
+                            int(width * 4)) != 0;
+    }
+    else
+    {
+        std::vector<uint8_t> encoded;
+        const uint8_t*       data = pixels;
+        size_t               size = size_t(width) * height * 4;
+        if (format == ImageFormat::QOI)
+        {
+            encoded = encode_qoi(pixels, width, height);
+            data    = encoded.data();
+            size    = encoded.size();
+        }
+        std::ofstream f(path, std::ios::binary);
+        f.write(reinterpret_cast<const char*>(data), std::streamsize(size));
+        ok = bool(f);
+    }
+    if (!ok) std::cerr << "Failed to write " << path << '\n';
+    return ok;
+}
+
+// Renders into an offscreen framebuffer and reads frames back through a
+// ring of pixel buffer objects: glReadPixels only queues a copy into the
+// current PBO, and a PBO is mapped again `ringSize` frames later, by which
+// time its fence has normally signalled. Encoding and writing run on the
+// pool; when the encoder falls behind, end_frame() waits for the oldest
+// frame instead of queueing without bound.
+class FrameExporter
+{
+public:
+    // Stats for the progress report
+    size_t FramesCaptured = 0;
+    size_t MaxQueueDepth  = 0;
+
+    FrameExporter()                                = default;
+    FrameExporter(const FrameExporter&)            = delete;
+    FrameExporter& operator=(const FrameExporter&) = delete;
+
+    ~FrameExporter()
+    {
+        if (fbo_) glDeleteFramebuffers(1, &fbo_);
+        if (color_) glDeleteRenderbuffers(1, &color_);
+        if (depth_) glDeleteRenderbuffers(1, &depth_);
+        for (auto& slot : ring_)
+        {
+            if (slot.fence) glDeleteSync(slot.fence);
+            glDeleteBuffers(1, &slot.pbo);
+        }
+    }
+
+    bool init(uint32_t           width,
+              uint32_t           height,
+              ImageFormat        format,
+              const std::string& directory,
+              ThreadPool&        pool,
+              size_t             ringSize = 3)
+    {
+        width_     = width;
+        height_    = height;
+        format_    = format;
+        directory_ = directory;
+        pool_      = &pool;
+        maxQueue_  = std::max<size_t>(2, pool.size() * 2);
+
+        std::error_code ec;
+        std::filesystem::create_directories(directory, ec);
+        if (ec)
+        {
+            std::cerr << "Failed to create " << directory << ": "
+                      << ec.message() << '\n';
+            return false;
+        }
+
+        glGenRenderbuffers(1, &color_);
+        glBindRenderbuffer(GL_RENDERBUFFER, color_);
+        glRenderbufferStorage(
+            GL_RENDERBUFFER, GL_RGBA8, GLsizei(width), GLsizei(height));
+        glGenRenderbuffers(1, &depth_);
+        glBindRenderbuffer(GL_RENDERBUFFER, depth_);
+        glRenderbufferStorage(GL_RENDERBUFFER,
+                              GL_DEPTH_COMPONENT24,
+                              GLsizei(width),
+                              GLsizei(height));
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glGenFramebuffers(1, &fbo_);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+        glFramebufferRenderbuffer(
+            GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_);
+        glFramebufferRenderbuffer(
+            GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_);
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) ==
+                        GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (!complete)
+        {
+            std::cerr << "Export framebuffer is incomplete\n";
+            return false;
+        }
+
+        ring_.resize(std::max<size_t>(2, ringSize));
+        for (auto& slot : ring_)
+        {
+            glGenBuffers(1, &slot.pbo);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+            glBufferData(
+                GL_PIXEL_PACK_BUFFER, frame_bytes(), nullptr, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return true;
+    }
+
+    uint32_t width() const { return width_; }
+    uint32_t height() const { return height_; }
+
+    // Frames encoded or waiting to be encoded
+    size_t queue_depth() const { return queued_.load(); }
+
+    // Binds the offscreen target; draw the frame after this
+    void begin_frame()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+        glViewport(0, 0, GLsizei(width_), GLsizei(height_));
+    }
+
+    // Queues the readback of the frame just drawn. `name` replaces the
+    // default frame_NNNNN file name (without extension).
+    void end_frame(const std::string& name = "")
+    {
+        Slot& slot = ring_[frame_ % ring_.size()];
+        if (slot.fence) collect(slot);
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glReadPixels(0,
+                     0,
+                     GLsizei(width_),
+                     GLsizei(height_),
+                     GL_RGBA,
+                     GL_UNSIGNED_BYTE,
+                     nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.frame = frame_++;
+        slot.name  = name;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Collects outstanding readbacks and waits for every file to be written
+    void finish()
+    {
+        for (size_t i = 0; i < ring_.size(); i++)
+        {
+            Slot& slot = ring_[(frame_ + i) % ring_.size()];
+            if (slot.fence) collect(slot);
+        }
+        while (!pending_.empty())
+        {
+            pending_.front().get();
+            pending_.pop_front();
+        }
+    }
+
+private:
+    struct Slot
+    {
+        unsigned int pbo   = 0;
+        GLsync       fence = nullptr;
+        size_t       frame = 0;
+        std::string  name;
+    };
+
+    GLsizeiptr frame_bytes() const
+    {
+        return GLsizeiptr(width_) * height_ * 4;
+    }
+
+    // Maps a finished PBO, copies it out flipped to top-down rows and hands
+    // the copy to the pool
+    void collect(Slot& slot)
+    {
+        glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+
+        auto   pixels = std::make_shared<std::vector<uint8_t>>(frame_bytes());
+        size_t row    = size_t(width_) * 4;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        const auto* src = static_cast<const uint8_t*>(glMapBufferRange(
+            GL_PIXEL_PACK_BUFFER, 0, frame_bytes(), GL_MAP_READ_BIT));
+        if (src)
+        {
+            for (uint32_t y = 0; y < height_; y++)
+                std::copy(src + (height_ - 1 - y) * row,
+                          src + (height_ - y) * row,
+                          pixels->data() + y * row);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if (!src)
+        {
+            std::cerr << "Failed to map frame " << slot.frame << '\n';
+            return;
+        }
+
+        // Bound the number of frames held in memory
+        while (pending_.size() >= maxQueue_)
+        {
+            pending_.front().get();
+            pending_.pop_front();
+        }
+
+        std::string name = slot.name;
+        if (name.empty())
+        {
+            char frame[16];
+            std::snprintf(frame, sizeof(frame), "frame_%05zu", slot.frame);
+            name = frame;
+        }
+        name += image_extension(format_);
+        std::string path = (std::filesystem::path(directory_) / name).string();
+
+        MaxQueueDepth = std::max(MaxQueueDepth, ++queued_);
+        pending_.push_back(pool_->submit(
+            [this, pixels, path]
+            {
+                write_image_file(
+                    path, format_, pixels->data(), width_, height_);
+                queued_--;
+            }));
+        FramesCaptured++;
+    }
+
+    uint32_t                      width_    = 0;
+    uint32_t                      height_   = 0;
+    ImageFormat                   format_   = ImageFormat::PNG;
+    std::string                   directory_;
+    ThreadPool*                   pool_     = nullptr;
+    size_t                        maxQueue_ = 2;
+    unsigned int                  fbo_ = 0, color_ = 0, depth_ = 0;
+    std::vector<Slot>             ring_;
+    size_t                        frame_ = 0;
+    std::deque<std::future<void>> pending_;
+    std::atomic<size_t>           queued_{ 0 };
+};
@@ -0,0 +1,94 @@
+#pragma once
+#include "culling.h"
+#include "mesh.h"
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <climits>
+#include <vector>
+
+// The vertex soup split into size-bounded GL buffers, one VAO per page, so
+// no single allocation has to hold the whole model. Draws index vertices
+// relative to their page.
+class GeometryPages
+{
+public:
+    size_t Bytes = 0; // uploaded vertex data
+
+    // Largest page of `pageBytes` for the format. Draw counts are GLsizei,
+    // so a page never holds more than INT_MAX vertices.
+    static size_t page_vertices(size_t pageBytes, const VertexFormat& fmt)
+    {
+        size_t vertexBytes = fmt.stride * sizeof(float);
+        return std::min<size_t>(pageBytes / vertexBytes, INT_MAX);
+    }
+
+    // Uploads every page of `vertices`, reusing buffers from an earlier
+    // upload. With an `instanceBuffer` the VAOs also read one transform per
+    // instance (attributes 3-6), otherwise those keep their identity value.
+    void upload(const std::vector<float>&    vertices,
+                const VertexFormat&          fmt,
+                const std::vector<PageSpan>& pages,
+                GLuint                       instanceBuffer,
+                GLenum                       usage = GL_STATIC_DRAW)
+    {
+        if (vaos_.size() < pages.size())
+        {
+            size_t old = vaos_.size();
+            vaos_.resize(pages.size());
+            vbos_.resize(pages.size());
+            glGenVertexArrays(GLsizei(pages.size() - old), &vaos_[old]);
+            glGenBuffers(GLsizei(pages.size() - old), &vbos_[old]);
+        }
+        spans_ = pages;
+        Bytes  = 0;
+
+        for (size_t p = 0; p < pages.size(); p++)
+        {
+            GLsizeiptr bytes = GLsizeiptr(pages[p].count) * fmt.stride *
+                               GLsizeiptr(sizeof(float));
+            glBindVertexArray(vaos_[p]);
+            glBindBuffer(GL_ARRAY_BUFFER, vbos_[p]);
+            glBufferData(GL_ARRAY_BUFFER,
+                         bytes,
+                         &vertices[pages[p].first * fmt.stride],
+                         usage);
+            fmt.ops->setupAttributes();
+            Bytes += size_t(bytes);
+
+            if (instanceBuffer == 0) continue;
+            glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+            for (int column = 0; column < 4; column++)
+            {
+                glVertexAttribPointer(3 + column,
+                                      4,
+                                      GL_FLOAT,
+                                      GL_FALSE,
+                                      sizeof(MeshInstance),
+                                      (void*)(column * sizeof(glm::vec4)));
+                glVertexAttribDivisor(3 + column, 1);
+                glEnableVertexAttribArray(3 + column);
+            }
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    size_t          size() const { return spans_.size(); }
+    const PageSpan& span(size_t page) const { return spans_[page]; }
+    void            bind(size_t page) const { glBindVertexArray(vaos_[page]); }
+
+    void release()
+    {
+        if (vaos_.empty()) return;
+        glDeleteVertexArrays(GLsizei(vaos_.size()), vaos_.data());
+        glDeleteBuffers(GLsizei(vbos_.size()), vbos_.data());
+        vaos_.clear();
+        vbos_.clear();
+        spans_.clear();
+        Bytes = 0;
+    }
+
+private:
+    std::vector<PageSpan> spans_;
+    std::vector<GLuint>   vaos_, vbos_;
+};
@@ -0,0 +1,232 @@
+#pragma once
+#include "texture_compress.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Minimal KTX2 reader/writer for the block-compressed 2D textures produced
+// by the texture converter: one layer, one face, no supercompression.
+namespace ktx2
+{
+    const uint8_t IDENTIFIER[12] = {
+        0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A
+    };
+
+    // VkFormat values
+    const uint32_t VK_FORMAT_BC1_RGB_UNORM_BLOCK = 131;
+    const uint32_t VK_FORMAT_BC3_UNORM_BLOCK     = 137;
+    const uint32_t VK_FORMAT_BC5_UNORM_BLOCK     = 141;
+
+    inline uint32_t vk_format(BlockFormat fmt)
+    {
+        switch (fmt)
+        {
+        case BlockFormat::BC1: return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+        case BlockFormat::BC3: return VK_FORMAT_BC3_UNORM_BLOCK;
+        case BlockFormat::BC5: return VK_FORMAT_BC5_UNORM_BLOCK;
+        }
+        return 0;
+    }
+
+    inline bool block_format(uint32_t vkFormat, BlockFormat& fmt)
+    {
+        switch (vkFormat)
+        {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK: fmt = BlockFormat::BC1; return true;
+        case VK_FORMAT_BC3_UNORM_BLOCK: fmt = BlockFormat::BC3; return true;
+        case VK_FORMAT_BC5_UNORM_BLOCK: fmt = BlockFormat::BC5; return true;
+        default: return false;
+        }
+    }
+
+    // Packed because the u64 fields sit at file offset 64, directly after
+    // the u32 fields, with the 12 byte identifier in front
+#pragma pack(push, 1)
+    struct Header
+    {
+        uint32_t vkFormat;
+        uint32_t typeSize;
+        uint32_t pixelWidth;
+        uint32_t pixelHeight;
+        uint32_t pixelDepth;
+        uint32_t layerCount;
+        uint32_t faceCount;
+        uint32_t levelCount;
+        uint32_t supercompressionScheme;
+        uint32_t dfdByteOffset;
+        uint32_t dfdByteLength;
+        uint32_t kvdByteOffset;
+        uint32_t kvdByteLength;
+        uint64_t sgdByteOffset;
+        uint64_t sgdByteLength;
+    };
+#pragma pack(pop)
+
+    struct LevelIndex
+    {
+        uint64_t byteOffset;
+        uint64_t byteLength;
+        uint64_t uncompressedByteLength;
+    };
+
+    // Basic data format descriptor for the BCn formats above
+    inline std::vector<uint32_t> build_dfd(BlockFormat fmt)
+    {
+        // KHR_DF_MODEL_* and KHR_DF_CHANNEL_* values
+        const uint32_t modelBC1 = 128, modelBC3 = 130, modelBC5 = 132;
+        struct Sample
+        {
+            uint32_t offset, channel;
+        };
+        std::vector<Sample> samples;
+        uint32_t            model = 0;
+        switch (fmt)
+        {
+        case BlockFormat::BC1:
+            model   = modelBC1;
+            samples = { { 0, 0 } };
+            break;
+        case BlockFormat::BC3:
+            model   = modelBC3;
+            samples = { { 0, 15 }, { 64, 0 } }; // alpha block, then colour
+            break;
+        case BlockFormat::BC5:
+            model   = modelBC5;
+            samples = { { 0, 0 }, { 64, 1 } }; // red, then green
+            break;
+        }
+
+        uint32_t              blockSize = 24 + 16 * uint32_t(samples.size());
+        std::vector<uint32_t> dfd;
+        dfd.push_back(4 + blockSize);                // dfdTotalSize
+        dfd.push_back(0);                            // vendor 0, type 0
+        dfd.push_back(2 | (blockSize << 16));        // version 2, block size
+        dfd.push_back(model | (1 << 8) | (1 << 16)); // BT709, linear
+        dfd.push_back(3 | (3 << 8));                 // 4x4x1x1 texel block
+        dfd.push_back(uint32_t(block_bytes(fmt)));   // bytesPlane0
+        dfd.push_back(0);                            // bytesPlane4-7
+        for (const auto& s : samples)
+        {
+            dfd.push_back(s.offset | (63 << 16) | (s.channel << 24));
+            dfd.push_back(0);          // sample position
+            dfd.push_back(0);          // sampleLower
+            dfd.push_back(0xFFFFFFFF); // sampleUpper
+        }
+        return dfd;
+    }
+
+    // `levels` holds compressed mip data, level 0 (largest) first
+    inline bool write(const std::string&                      path,
+                      BlockFormat                             fmt,
+                      uint32_t                                width,
+                      uint32_t                                height,
+                      const std::vector<std::vector<uint8_t>>& levels)
+    {
+        std::vector<uint32_t> dfd = build_dfd(fmt);
+
+        Header header{};
+        header.vkFormat      = vk_format(fmt);
+        header.typeSize      = 1;
+        header.pixelWidth    = width;
+        header.pixelHeight   = height;
+        header.faceCount     = 1;
+        header.levelCount    = uint32_t(levels.size());
+        header.dfdByteOffset = uint32_t(sizeof(IDENTIFIER) + sizeof(Header) +
+                                        levels.size() * sizeof(LevelIndex));
+        header.dfdByteLength = uint32_t(dfd.size() * sizeof(uint32_t));
+
+        // Mip data is stored smallest level first, each level aligned to
+        // the block size
+        uint64_t align  = block_bytes(fmt);
+        uint64_t offset = header.dfdByteOffset + header.dfdByteLength;
+        std::vector<LevelIndex> index(levels.size());
+        for (size_t i = levels.size(); i-- > 0;)
+        {
+            offset   = (offset + align - 1) / align * align;
+            index[i] = { offset, levels[i].size(), levels[i].size() };
+            offset += levels[i].size();
+        }
+
+        std::ofstream f(path, std::ios::binary);
+        if (!f) return false;
+        f.write(reinterpret_cast<const char*>(IDENTIFIER), sizeof(IDENTIFIER));
+        f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        f.write(reinterpret_cast<const char*>(index.data()),
+                std::streamsize(index.size() * sizeof(LevelIndex)));
+        f.write(reinterpret_cast<const char*>(dfd.data()),
+                std::streamsize(header.dfdByteLength));
+        for (size_t i = levels.size(); i-- > 0;)
+        {
+            f.seekp(std::streamoff(index[i].byteOffset));
+            f.write(reinterpret_cast<const char*>(levels[i].data()),
+                    std::streamsize(levels[i].size()));
+        }
+        return bool(f);
+    }
+
+    // Reads the header eagerly and mip levels on demand, so a streaming
+    // worker can pull single levels without loading the whole file
+    class File
+    {
+    public:
+        bool open(const std::string& path)
+        {
+            path_ = path;
+            std::ifstream f(path, std::ios::binary);
+            uint8_t       id[sizeof(IDENTIFIER)];
+            if (!f.read(reinterpret_cast<char*>(id), sizeof(id)) ||
+                std::memcmp(id, IDENTIFIER, sizeof(id)) != 0)
+                return false;
+            if (!f.read(reinterpret_cast<char*>(&header_), sizeof(header_)))
+                return false;
+            if (header_.supercompressionScheme != 0 ||
+                !block_format(header_.vkFormat, format_) ||
+                header_.levelCount == 0)
+                return false;
+
+            levels_.resize(header_.levelCount);
+            return bool(f.read(reinterpret_cast<char*>(levels_.data()),
+                               std::streamsize(levels_.size() *
+                                               sizeof(LevelIndex))));
+        }
+
+        BlockFormat format() const { return format_; }
+        uint32_t    width() const { return header_.pixelWidth; }
+        uint32_t    height() const { return header_.pixelHeight; }
+        uint32_t    level_count() const { return header_.levelCount; }
+
+        uint64_t level_size(uint32_t level) const
+        {
+            return levels_[level].byteLength;
+        }
+
+        uint32_t level_width(uint32_t level) const
+        {
+            return std::max(1U, header_.pixelWidth >> level);
+        }
+
+        uint32_t level_height(uint32_t level) const
+        {
+            return std::max(1U, header_.pixelHeight >> level);
+        }
+
+        // Safe to call from any thread; every call opens its own stream
+        bool read_level(uint32_t level, std::vector<uint8_t>& data) const
+        {
+            std::ifstream f(path_, std::ios::binary);
+            data.resize(levels_[level].byteLength);
+            f.seekg(std::streamoff(levels_[level].byteOffset));
+            return bool(f.read(reinterpret_cast<char*>(data.data()),
+                               std::streamsize(data.size())));
+        }
+
+    private:
+        std::string             path_;
+        Header                  header_{};
+        BlockFormat             format_ = BlockFormat::BC1;
+        std::vector<LevelIndex> levels_;
+    };
+} // namespace ktx2
@@ -0,0 +1,187 @@
+#pragma once
+#include <glad/glad.h>
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Percentiles of a window of latency samples, in milliseconds
+struct LatencyPercentiles
+{
+    size_t count = 0;
+    double p50   = 0.0;
+    double p95   = 0.0;
+    double p99   = 0.0;
+};
+
+inline LatencyPercentiles latency_percentiles(std::vector<double> samples)
+{
+    LatencyPercentiles p;
+    p.count = samples.size();
+    if (samples.empty()) return p;
+
+    std::sort(samples.begin(), samples.end());
+    auto at = [&](double q)
+    { return samples[size_t(q * (samples.size() - 1) + 0.5)]; };
+    p.p50 = at(0.50);
+    p.p95 = at(0.95);
+    p.p99 = at(0.99);
+    return p;
+}
+
+// Input-to-photon latency of presented frames. A frame carries the time of
+// the oldest input it shows. Its submit time is taken just before the swap,
+// and a GL_TIMESTAMP query and a fence issued right after the swap give the
+// time the GPU finished it, which is as close to the photon as GL gets
+// (display scanout is not included). Times are seconds on the caller's
+// clock; GPU timestamps are mapped onto it by periodic calibration.
+// The fences also count the frames in flight for low-latency pacing.
+class LatencyTracker
+{
+public:
+    static constexpr size_t WINDOW = 240; // frames kept for percentiles
+    static constexpr int    SLOTS  = 8;   // frames tracked at once
+
+    int FrameLimit = 0; // low-latency pacing limit, 0 leaves it to the driver
+
+    void init(double now)
+    {
+        glGenQueries(SLOTS, queries_);
+        calibrate(now);
+    }
+
+    // Input to the last command of its frame, and to GPU completion
+    LatencyPercentiles submit_latency() const
+    {
+        return latency_percentiles({ submitMs_.begin(), submitMs_.end() });
+    }
+    LatencyPercentiles photon_latency() const
+    {
+        return latency_percentiles({ photonMs_.begin(), photonMs_.end() });
+    }
+
+    int in_flight() const
+    {
+        int n = 0;
+        for (const Slot& s : slots_)
+            n += s.fence != nullptr;
+        return n;
+    }
+
+    // Call right after the swap. `input` is negative for frames that show
+    // no new input; those are still fenced for pacing.
+    void frame_swapped(double input, double submit, double now)
+    {
+        collect();
+        if (++frames_ % CALIBRATE_FRAMES == 0) calibrate(now);
+
+        // Frames beyond SLOTS queued on the GPU are not tracked
+        int free = -1;
+        for (int i = 0; i < SLOTS && free < 0; i++)
+            if (!slots_[i].fence) free = i;
+        if (free < 0) return;
+
+        Slot& slot = slots_[free];
+        glQueryCounter(queries_[free], GL_TIMESTAMP);
+        slot.fence    = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.input    = input;
+        slot.submit   = submit;
+        slot.sequence = frames_;
+        if (input >= 0.0) push(submitMs_, (submit - input) * 1000.0);
+    }
+
+    // Records every frame the GPU has finished, without blocking
+    void collect()
+    {
+        for (int i = 0; i < SLOTS; i++)
+            if (slots_[i].fence &&
+                glClientWaitSync(slots_[i].fence, 0, 0) != GL_TIMEOUT_EXPIRED)
+                finish(i);
+    }
+
+    // Blocks until fewer than `maxInFlight` frames are queued on the GPU
+    void wait_for_frames(int maxInFlight)
+    {
+        collect();
+        while (in_flight() >= std::max(maxInFlight, 1))
+        {
+            int oldest = -1;
+            for (int i = 0; i < SLOTS; i++)
+                if (slots_[i].fence &&
+                    (oldest < 0 ||
+                     slots_[i].sequence < slots_[oldest].sequence))
+                    oldest = i;
+
+            GLenum result = GL_TIMEOUT_EXPIRED;
+            while (result == GL_TIMEOUT_EXPIRED)
+                result = glClientWaitSync(slots_[oldest].fence,
+                                          GL_SYNC_FLUSH_COMMANDS_BIT,
+                                          /*timeout ns=*/100000000);
+            finish(oldest);
+        }
+    }
+
+    // Drops the samples, keeping frames in flight
+    void reset()
+    {
+        submitMs_.clear();
+        photonMs_.clear();
+    }
+
+    void release()
+    {
+        for (int i = 0; i < SLOTS; i++)
+        {
+            if (slots_[i].fence) glDeleteSync(slots_[i].fence);
+            slots_[i] = Slot{};
+        }
+        glDeleteQueries(SLOTS, queries_);
+        std::fill(queries_, queries_ + SLOTS, 0U);
+    }
+
+private:
+    static constexpr size_t CALIBRATE_FRAMES = 120;
+
+    struct Slot
+    {
+        GLsync fence    = nullptr;
+        double input    = -1.0;
+        double submit   = 0.0;
+        size_t sequence = 0;
+    };
+
+    void finish(int i)
+    {
+        Slot& s = slots_[i];
+        if (s.input >= 0.0)
+        {
+            GLuint64 gpu = 0;
+            glGetQueryObjectui64v(queries_[i], GL_QUERY_RESULT, &gpu);
+            // Calibration error must not place completion before submit
+            double done = std::max(gpu * 1e-9 - gpuOffset_, s.submit);
+            push(photonMs_, (done - s.input) * 1000.0);
+        }
+        glDeleteSync(s.fence);
+        s = Slot{};
+    }
+
+    // Offset from the caller's clock to the GPU timestamp clock
+    void calibrate(double now)
+    {
+        GLint64 gpu = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpu);
+        gpuOffset_ = gpu * 1e-9 - now;
+    }
+
+    static void push(std::deque<double>& window, double ms)
+    {
+        window.push_back(ms);
+        if (window.size() > WINDOW) window.pop_front();
+    }
+
+    GLuint             queries_[SLOTS] = {};
+    Slot               slots_[SLOTS];
+    size_t             frames_    = 0;
+    double             gpuOffset_ = 0.0;
+    std::deque<double> submitMs_, photonMs_;
+};
@@ -0,0 +1,290 @@
+#pragma once
+#include "thread_pool.h"
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+struct PointLight
+{
+    glm::vec3 position;
+    float     radius;
+    glm::vec3 color;
+    float     intensity;
+};
+
+// Scatters `count` lights through the scene bounds. The same seed always
+// produces the same lights so benchmark runs are comparable.
+std::vector<PointLight> generate_lights(size_t           count,
+                                        const glm::vec3& boxMin,
+                                        const glm::vec3& boxMax,
+                                        unsigned int     seed = 1234)
+{
+    std::mt19937                          rng(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    glm::vec3 size      = boxMax - boxMin;
+    float     maxExtent = std::max({ size.x, size.y, size.z });
+
+    std::vector<PointLight> lights(count);
+    for (auto& l : lights)
+    {
+        l.position  = boxMin + glm::vec3(unit(rng), unit(rng), unit(rng)) * size;
+        l.radius    = maxExtent * (0.05f + 0.15f * unit(rng));
+        l.color     = glm::vec3(0.2f) +
+                  glm::vec3(unit(rng), unit(rng), unit(rng)) * 0.8f;
+        l.intensity = 1.0f;
+    }
+    return lights;
+}
+
+// Clustered forward shading. The view frustum is split into a froxel grid
+// with exponential depth slices; every frame each light is assigned to the
+// froxels its bounding sphere touches, in parallel over depth slices. The
+// per-froxel light lists go to texture buffers so fragment.glsl only loops
+// over the lights that can reach the fragment.
+class ClusteredLighting
+{
+public:
+    static constexpr unsigned int GRID_X        = 16;
+    static constexpr unsigned int GRID_Y        = 9;
+    static constexpr unsigned int GRID_Z        = 24;
+    static constexpr unsigned int CLUSTER_COUNT = GRID_X * GRID_Y * GRID_Z;
+
+    double       AssignMs      = 0.0; // CPU time of the last update()
+    unsigned int AssignedLinks = 0;   // light/froxel pairs of the last update()
+
+    void init()
+    {
+        glGenBuffers(3, buffers_);
+        glGenTextures(3, textures_);
+        const GLenum formats[] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+        for (int i = 0; i < 3; i++)
+        {
+            glBindBuffer(GL_TEXTURE_BUFFER, buffers_[i]);
+            glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_DYNAMIC_DRAW);
+            glBindTexture(GL_TEXTURE_BUFFER, textures_[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers_[i]);
+        }
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void set_lights(const std::vector<PointLight>& lights)
+    {
+        lights_ = lights;
+        upload(buffers_[0], lights_.data(), lights_.size() * sizeof(PointLight));
+    }
+
+    size_t light_count() const { return lights_.size(); }
+
+    // Rebuilds the froxel light lists for the given camera
+    void update(const glm::mat4& view,
+                const glm::mat4& proj,
+                float            zNear,
+                float            zFar,
+                ThreadPool&      pool)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        if (proj != cachedProj_ || zNear != zNear_ || zFar != zFar_)
+        {
+            cachedProj_ = proj;
+            zNear_      = zNear;
+            zFar_       = zFar;
+            build_froxel_bounds();
+        }
+
+        // View-space light spheres, z flipped to a positive depth
+        std::vector<glm::vec4> spheres(lights_.size());
+        for (size_t i = 0; i < lights_.size(); i++)
+        {
+            glm::vec4 v = view * glm::vec4(lights_[i].position, 1.0f);
+            spheres[i]  = glm::vec4(v.x, v.y, -v.z, lights_[i].radius);
+        }
+
+        // Each slice owns its froxels, so slices can be filled concurrently
+        pool.parallel_for(
+            GRID_Z,
+            1,
+            [&](size_t begin, size_t end)
+            {
+                for (size_t z = begin; z < end; z++)
+                    assign_slice(static_cast<unsigned int>(z), spheres);
+            });
+
+        // Concatenate the per-slice lists into one index buffer
+        grid_.resize(CLUSTER_COUNT * 2);
+        indices_.clear();
+        for (unsigned int z = 0; z < GRID_Z; z++)
+        {
+            const auto& slice = slices_[z];
+            for (unsigned int c = 0; c < GRID_X * GRID_Y; c++)
+            {
+                size_t cluster = z * GRID_X * GRID_Y + c;
+                grid_[cluster * 2] = static_cast<uint32_t>(indices_.size() +
+                                                           slice.offsets[c]);
+                grid_[cluster * 2 + 1] = slice.counts[c];
+            }
+            indices_.insert(
+                indices_.end(), slice.indices.begin(), slice.indices.end());
+        }
+        AssignedLinks = static_cast<unsigned int>(indices_.size());
+
+        upload(buffers_[1], grid_.data(), grid_.size() * sizeof(uint32_t));
+        upload(buffers_[2], indices_.data(), indices_.size() * sizeof(uint32_t));
+
+        AssignMs = std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+    }
+
+    // Binds the light buffers to texture units 1-3 and sets the uniforms
+    // fragment.glsl needs. `clustered` false makes the shader loop over
+    // every light, which is only useful as a benchmark baseline.
+    // `tileOffset` places a tile rendered on its own within the full
+    // screen, in pixels from its bottom-left corner.
+    void bind(unsigned int program,
+              int          screenWidth,
+              int          screenHeight,
+              bool         clustered  = true,
+              glm::vec2    tileOffset = glm::vec2(0.0f)) const
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            glActiveTexture(GL_TEXTURE1 + i);
+            glBindTexture(GL_TEXTURE_BUFFER, textures_[i]);
+        }
+        glActiveTexture(GL_TEXTURE0);
+
+        glUniform1i(glGetUniformLocation(program, "lightData"), 1);
+        glUniform1i(glGetUniformLocation(program, "lightGrid"), 2);
+        glUniform1i(glGetUniformLocation(program, "lightIndices"), 3);
+        glUniform1i(glGetUniformLocation(program, "lightCount"),
+                    static_cast<GLint>(lights_.size()));
+        glUniform1i(glGetUniformLocation(program, "useClustering"),
+                    clustered ? 1 : 0);
+        glUniform3ui(
+            glGetUniformLocation(program, "gridSize"), GRID_X, GRID_Y, GRID_Z);
+        glUniform2f(glGetUniformLocation(program, "screenSize"),
+                    static_cast<float>(screenWidth),
+                    static_cast<float>(screenHeight));
+        glUniform2f(glGetUniformLocation(program, "tileOffset"),
+                    tileOffset.x,
+                    tileOffset.y);
+        glUniform1f(glGetUniformLocation(program, "zNear"), zNear_);
+        glUniform1f(glGetUniformLocation(program, "zFar"), zFar_);
+    }
+
+private:
+    struct Slice
+    {
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> counts;
+        std::vector<uint32_t> indices;
+    };
+
+    struct FroxelBounds
+    {
+        glm::vec3 min;
+        glm::vec3 max;
+    };
+
+    float slice_depth(unsigned int z) const
+    {
+        return zNear_ * std::pow(zFar_ / zNear_, float(z) / float(GRID_Z));
+    }
+
+    // View-space AABB of every froxel. Depth is stored positive.
+    void build_froxel_bounds()
+    {
+        froxels_.resize(CLUSTER_COUNT);
+        for (unsigned int z = 0; z < GRID_Z; z++)
+        {
+            float depths[2] = { slice_depth(z), slice_depth(z + 1) };
+            for (unsigned int y = 0; y < GRID_Y; y++)
+                for (unsigned int x = 0; x < GRID_X; x++)
+                {
+                    float ndcX[2] = { -1.0f + 2.0f * x / GRID_X,
+                                      -1.0f + 2.0f * (x + 1) / GRID_X };
+                    float ndcY[2] = { -1.0f + 2.0f * y / GRID_Y,
+                                      -1.0f + 2.0f * (y + 1) / GRID_Y };
+
+                    FroxelBounds b{ glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+                    for (float d : depths)
+                        for (float nx : ndcX)
+                            for (float ny : ndcY)
+                            {
+                                glm::vec3 p(nx * d / cachedProj_[0][0],
+                                            ny * d / cachedProj_[1][1],
+                                            d);
+                                b.min = glm::min(b.min, p);
+                                b.max = glm::max(b.max, p);
+                            }
+                    froxels_[(z * GRID_Y + y) * GRID_X + x] = b;
+                }
+        }
+        slices_.resize(GRID_Z);
+    }
+
+    void assign_slice(unsigned int z, const std::vector<glm::vec4>& spheres)
+    {
+        Slice& slice = slices_[z];
+        slice.offsets.assign(GRID_X * GRID_Y, 0);
+        slice.counts.assign(GRID_X * GRID_Y, 0);
+        slice.indices.clear();
+
+        float sliceNear = slice_depth(z), sliceFar = slice_depth(z + 1);
+
+        // Lights touching this slice, tested once instead of per froxel
+        std::vector<uint32_t> candidates;
+        for (size_t i = 0; i < spheres.size(); i++)
+            if (spheres[i].z + spheres[i].w >= sliceNear &&
+                spheres[i].z - spheres[i].w <= sliceFar)
+                candidates.push_back(static_cast<uint32_t>(i));
+
+        for (unsigned int c = 0; c < GRID_X * GRID_Y; c++)
+        {
+            const FroxelBounds& b = froxels_[z * GRID_X * GRID_Y + c];
+            slice.offsets[c]      = static_cast<uint32_t>(slice.indices.size());
+            for (uint32_t i : candidates)
+            {
+                glm::vec3 center(spheres[i]);
+                glm::vec3 closest = glm::clamp(center, b.min, b.max);
+                glm::vec3 d       = closest - center;
+                if (glm::dot(d, d) <= spheres[i].w * spheres[i].w)
+                    slice.indices.push_back(i);
+            }
+            slice.counts[c] = static_cast<uint32_t>(slice.indices.size()) -
+                              slice.offsets[c];
+        }
+    }
+
+    static void upload(unsigned int buffer, const void* data, size_t bytes)
+    {
+        // Texture buffers must not be empty
+        const uint32_t dummy[4] = {};
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        glBufferData(GL_TEXTURE_BUFFER,
+                     bytes ? bytes : sizeof(dummy),
+                     bytes ? data : dummy,
+                     GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    std::vector<PointLight>   lights_;
+    std::vector<FroxelBounds> froxels_;
+    std::vector<Slice>        slices_;
+    std::vector<uint32_t>     grid_;
+    std::vector<uint32_t>     indices_;
+    glm::mat4                 cachedProj_{ 0.0f };
+    float                     zNear_ = 0.0f;
+    float                     zFar_  = 0.0f;
+    unsigned int              buffers_[3]  = {};
+    unsigned int              textures_[3] = {};
+};
@@ -2,9 +2,26 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <GL/freeglut.h>
+#include "bvh.h"
 #include "camera.h"
+#include "batch.h"
+#include "culling.h"
+#include "distributed.h"
+#include "frame_export.h"
+#include "geometry_pages.h"
+#include "latency.h"
+#include "lights.h"
 #include "mesh.h"
+#include "mesh_cache.h"
+#include "occlusion.h"
+#include "options.h"
+#include "postprocess.h"
+#include "redraw.h"
+#include "startup.h"
+#include "textures.h"
+#include "thread_pool.h"
 #include <algorithm>
+#include <chrono>
 #include <assimp/Importer.hpp>
 #include <ft2build.h>
 #include <map>
@@ -32,26 +49,38 @@ struct Character
 
 std::map<char, Character> characters;
 
-void load_font(const char* fontPath)
+// A glyph rendered by FreeType, waiting for its texture upload
+struct GlyphBitmap
 {
-    FT_Library ft;
+    unsigned char              c;
+    glm::ivec2                 size;
+    glm::ivec2                 bearing;
+    unsigned int               advance;
+    std::vector<unsigned char> pixels; // size.x * size.y, tightly packed
+};
+
+// Renders the first 128 characters. Touches no GL state, so it runs on a
+// worker while the context is created.
+std::vector<GlyphBitmap> rasterize_font(const char* fontPath)
+{
+    std::vector<GlyphBitmap> glyphs;
+    FT_Library               ft;
     if (FT_Init_FreeType(&ft))
     {
         std::cerr << "ERROR::FREETYPE: Could not init FreeType Library\n";
-        return;
+        return glyphs;
     }
 
     FT_Face face;
     if (FT_New_Face(ft, fontPath, 0, &face))
     {
         std::cerr << "ERROR::FREETYPE: Failed to load font\n";
-        return;
+        FT_Done_FreeType(ft);
+        return glyphs;
     }
 
     FT_Set_Pixel_Sizes(face, 0, 48); // Set font size
 
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // Disable byte-alignment restriction
-
     for (unsigned char c = 0; c < 128; c++)
     {
         if (FT_Load_Char(face, c, FT_LOAD_RENDER))
@@ -60,6 +89,32 @@ void load_font(const char* fontPath)
             continue;
         }
 
+        const FT_Bitmap& bitmap = face->glyph->bitmap;
+        GlyphBitmap      g;
+        g.c       = c;
+        g.size    = { bitmap.width, bitmap.rows };
+        g.bearing = { face->glyph->bitmap_left, face->glyph->bitmap_top };
+        g.advance = (unsigned int)face->glyph->advance.x;
+        g.pixels.resize(size_t(bitmap.width) * bitmap.rows);
+        for (unsigned int row = 0; row < bitmap.rows; row++)
+            std::copy_n(bitmap.buffer + row * bitmap.pitch,
+                        bitmap.width,
+                        g.pixels.data() + size_t(row) * bitmap.width);
+        glyphs.push_back(std::move(g));
+    }
+
+    FT_Done_Face(face);
+    FT_Done_FreeType(ft);
+    return glyphs;
+}
+
+// Creates one texture per glyph. Needs the context.
+void upload_font(const std::vector<GlyphBitmap>& glyphs)
+{
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // Disable byte-alignment restriction
+
+    for (const GlyphBitmap& g : glyphs)
+    {
         GLuint texture;
         glGenTextures(1, &texture);
         glBindTexture(GL_TEXTURE_2D, texture);
@@ -67,27 +122,21 @@ void load_font(const char* fontPath)
         glTexImage2D(GL_TEXTURE_2D,
                      0,
                      GL_RED,
-                     face->glyph->bitmap.width,
-                     face->glyph->bitmap.rows,
+                     g.size.x,
+                     g.size.y,
                      0,
                      GL_RED,
                      GL_UNSIGNED_BYTE,
-                     face->glyph->bitmap.buffer);
+                     g.pixels.empty() ? nullptr : g.pixels.data());
 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-        Character ch = { texture,
-                         { face->glyph->bitmap.width, face->glyph->bitmap.rows },
-                         { face->glyph->bitmap_left, face->glyph->bitmap_top },
-                         (GLuint)face->glyph->advance.x };
-        characters.insert(std::pair<char, Character>(c, ch));
+        Character ch = { texture, g.size, g.bearing, g.advance };
+        characters.insert(std::pair<char, Character>(g.c, ch));
     }
-
-    FT_Done_Face(face);
-    FT_Done_FreeType(ft);
 }
 
 unsigned int textVAO, textVBO;
@@ -139,6 +188,22 @@ void render_text(const unsigned int& shader,
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+// One line of the debug overlay, at x = 10 in the 1600x1200 text space
+struct OverlayLine
+{
+    std::string text;
+    float       y;
+    float       scale = 0.5f;
+    glm::vec3   color = glm::vec3(1.0f);
+
+    bool operator==(const OverlayLine& o) const
+    {
+        return text == o.text && y == o.y && scale == o.scale &&
+               color == o.color;
+    }
+    bool operator!=(const OverlayLine& o) const { return !(*this == o); }
+};
+
 struct BoundingBox
 {
     glm::vec3 min;
@@ -160,6 +225,40 @@ BoundingBox compute_bounding_box(const std::vector<float>& vertices)
     return bbox;
 }
 
+// Auto-framing: camera distance at which a model of `maxExtent` fits in a
+// view with the given vertical FOV and aspect ratio
+float framing_distance(float maxExtent, float verticalFov, float aspectRatio)
+{
+    // Calculate distance to fit the entire bounding box in view
+    // Account for both vertical and horizontal FOV
+    float verticalDistance = (maxExtent * 0.5f) / std::tan(verticalFov * 0.5f);
+    float horizontalFov    = 2.0f *
+                          std::atan(std::tan(verticalFov * 0.5f) * aspectRatio);
+    float horizontalDistance = (maxExtent * 0.5f) /
+                               std::tan(horizontalFov * 0.5f);
+
+    // Use the larger distance to ensure the object fits in both dimensions
+    float distance = std::max(verticalDistance, horizontalDistance);
+
+    // Add some padding (multiply by 1.5) to ensure the object is
+    // comfortably in view
+    distance *= 1.5f;
+
+    // Ensure minimum distance to avoid being too close
+    return std::max(distance, maxExtent * 2.0f);
+}
+
+// Dynamic near/far planes for a camera `distance` away from the model
+void clip_planes(float distance, float& nearPlane, float& farPlane)
+{
+    nearPlane = distance * 0.01F; // 1% of distance
+    farPlane  = distance * 10.0F; // 10x distance
+
+    // Ensure reasonable bounds
+    nearPlane = std::max(nearPlane, 0.001F);
+    farPlane  = std::max(farPlane, nearPlane * 1000.0F);
+}
+
 // Rendering modes
 enum RenderMode : std::uint8_t
 {
@@ -177,11 +276,36 @@ double     deltaTime = 0, lastFrame = 0;
 RenderMode currentMode   = SHADED;
 bool       showDebugInfo = false;
 
+// Set when the window system asks for a repaint; the cached frame is
+// presented again without redrawing the scene
+bool frameExposed = false;
+
+// Picking state. The cursor is captured, so picks use the screen center.
+const SceneBvh* sceneBvh       = nullptr;
+bool            collideCamera  = false;
+bool            pickRequested  = false;
+bool            focusRequested = false;
+double          lastClickTime  = -1.0;
+
+// Time of the oldest input not yet on screen (glfwGetTime), -1 if none.
+// The next presented frame carries it to the latency tracker.
+double pendingInput = -1.0;
+
+void stamp_input()
+{
+    if (pendingInput < 0.0) pendingInput = glfwGetTime();
+}
+
 void framebuffer_size_callback(GLFWwindow*, int w, int h)
 {
     glViewport(0, 0, w, h);
 }
 
+void window_refresh_callback(GLFWwindow*)
+{
+    frameExposed = true;
+}
+
 void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 {
     if (firstMouse)
@@ -199,13 +323,58 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
     if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_MIDDLE) == GLFW_PRESS)
     {
         camera.process_mouse_movement(xoffset * 0.5, yoffset * 0.5);
+        stamp_input();
+    }
+    // Right button orbits around the focus point
+    else if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS)
+    {
+        camera.orbit(xoffset * 0.5, yoffset * 0.5);
+        stamp_input();
     }
 }
 
+// Left click picks, a second click within 0.3 s focuses
+void mouse_button_callback(GLFWwindow*, int button, int action, int)
+{
+    if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS) return;
+    stamp_input();
+
+    double now = glfwGetTime();
+    if (lastClickTime >= 0.0 && now - lastClickTime < 0.3)
+    {
+        focusRequested = true;
+        lastClickTime  = -1.0;
+    }
+    else
+    {
+        pickRequested = true;
+        lastClickTime = now;
+    }
+}
+
+// Moves the camera and, with --collide, stops it short of any triangle on
+// the way
+void move_camera(Camera_Movement dir, float dt)
+{
+    glm::vec3 from = camera.Position;
+    camera.process_keyboard(dir, dt);
+    if (!collideCamera || !sceneBvh) return;
+
+    glm::vec3 step = camera.Position - from;
+    float     len  = glm::length(step);
+    if (len <= 0.0f) return;
+
+    // Keep a margin so the near plane does not clip into the surface
+    float  margin = std::max(len, camera.SceneScale * 0.005f);
+    RayHit hit;
+    if (sceneBvh->intersect(from, step / len, len + margin, hit))
+        camera.Position = from + step / len * std::max(0.0f, hit.t - margin);
+}
+
 // Scroll callback for zoom functionality
 void scroll_callback(GLFWwindow*, double, double yoffset)
 {
-    camera.process_keyboard(yoffset > 0 ? FORWARD : BACKWARD, /*dt=*/0.1F);
+    move_camera(yoffset > 0 ? FORWARD : BACKWARD, /*dt=*/0.1F);
 }
 
 auto currentFPS   = 0.0; // Global variable to store current FPS
@@ -217,22 +386,35 @@ bool tabPressed = false;
 bool ePressed   = false;
 
 int windowedPosX, windowedPosY, windowedWidth, windowedHeight;
+
+// Keys that move the camera every frame while held, so the render loop
+// keeps polling instead of waiting for the next event
+bool movement_keys_held(GLFWwindow* win)
+{
+    const int keys[] = { GLFW_KEY_W,     GLFW_KEY_S,     GLFW_KEY_A,
+                         GLFW_KEY_D,     GLFW_KEY_SPACE, GLFW_KEY_LEFT_SHIFT };
+    for (int key : keys)
+        if (glfwGetKey(win, key) == GLFW_PRESS) return true;
+    return false;
+}
+
 void process_input(GLFWwindow* win)
 {
     auto dt = deltaTime;
+    if (movement_keys_held(win)) stamp_input();
 
     if (glfwGetKey(win, GLFW_KEY_W) == GLFW_PRESS)
-        camera.process_keyboard(FORWARD, dt);
+        move_camera(FORWARD, dt);
     if (glfwGetKey(win, GLFW_KEY_S) == GLFW_PRESS)
-        camera.process_keyboard(BACKWARD, dt);
+        move_camera(BACKWARD, dt);
     if (glfwGetKey(win, GLFW_KEY_A) == GLFW_PRESS)
-        camera.process_keyboard(LEFT, dt);
+        move_camera(LEFT, dt);
     if (glfwGetKey(win, GLFW_KEY_D) == GLFW_PRESS)
-        camera.process_keyboard(RIGHT, dt);
+        move_camera(RIGHT, dt);
     if (glfwGetKey(win, GLFW_KEY_SPACE) == GLFW_PRESS)
-        camera.process_keyboard(UP, dt);
+        move_camera(UP, dt);
     if (glfwGetKey(win, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS)
-        camera.process_keyboard(DOWN, dt);
+        move_camera(DOWN, dt);
     if (glfwGetKey(win, GLFW_KEY_Q) == GLFW_PRESS) std::exit(0);
 
     // Toggle fullscreen on F key press
@@ -275,6 +457,7 @@ else
         {
             currentMode = static_cast<RenderMode>((currentMode + 1) % MODE_COUNT);
             tabPressed = true;
+            stamp_input();
 
             const char* modeNames[] = { "Shaded", "Wireframe", "Random" };
             std::cout << "Render mode: " << modeNames[currentMode] << '\n';
@@ -292,6 +475,7 @@ else
         {
             showDebugInfo = !showDebugInfo;
             ePressed      = true;
+            stamp_input();
         }
     }
     else
@@ -313,38 +497,32 @@ std::string loadShader(const char* path)
     return s.str();
 }
 
-unsigned int create_shader_program(const char* vertex_shader_path,
-                                   const char* fragment_shader_path)
+unsigned int compile_shader(const std::string& src, GLenum type)
 {
-    std::string vSrc = loadShader(vertex_shader_path);
-    std::string fSrc = loadShader(fragment_shader_path);
+    const char*  code   = src.c_str();
+    unsigned int shader = glCreateShader(type);
+    glShaderSource(shader, 1, &code, nullptr);
+    glCompileShader(shader);
 
-    auto compile = [](const std::string& src, GLenum type)
+    int  success;
+    char infoLog[512];
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success)
     {
-        const char*  code   = src.c_str();
-        unsigned int shader = glCreateShader(type);
-        glShaderSource(shader, 1, &code, nullptr);
-        glCompileShader(shader);
-
-        int  success;
-        char infoLog[512];
-        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-        if (!success)
-        {
-            glGetShaderInfoLog(shader, 512, NULL, infoLog);
-            std::cerr << "ERROR::SHADER::COMPILATION_FAILED\n"
-                      << infoLog << std::endl;
-        }
-
-        return shader;
-    };
+        glGetShaderInfoLog(shader, 512, NULL, infoLog);
+        std::cerr << "ERROR::SHADER::COMPILATION_FAILED\n"
+                  << infoLog << std::endl;
+    }
 
-    unsigned int vShader = compile(vSrc, GL_VERTEX_SHADER);
-    unsigned int fShader = compile(fSrc, GL_FRAGMENT_SHADER);
+    return shader;
+}
 
+// Returns 0 if linking failed
+unsigned int link_program(const std::vector<unsigned int>& shaders)
+{
     unsigned int program = glCreateProgram();
-    glAttachShader(program, vShader);
-    glAttachShader(program, fShader);
+    for (auto shader : shaders)
+        glAttachShader(program, shader);
     glLinkProgram(program);
 
     int  success;
@@ -355,29 +533,739 @@ unsigned int create_shader_program(const char* vertex_shader_path,
         glGetProgramInfoLog(program, 512, NULL, infoLog);
         std::cerr << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
                   << infoLog << std::endl;
+        glDeleteProgram(program);
+        program = 0;
     }
 
-    glDeleteShader(vShader);
-    glDeleteShader(fShader);
+    for (auto shader : shaders)
+        glDeleteShader(shader);
     return program;
 }
 
+// Every shader source main builds, read ahead of the context
+struct ShaderSources
+{
+    std::string meshVertex, meshFragment;
+    std::string textVertex, textFragment;
+    std::string overlayVertex, overlayFragment;
+    std::string cullCompute;
+};
+
+ShaderSources load_shader_sources()
+{
+    ShaderSources s;
+    s.meshVertex      = loadShader("../shaders/vertex.glsl");
+    s.meshFragment    = loadShader("../shaders/fragment.glsl");
+    s.textVertex      = loadShader("../shaders/text_vertex.glsl");
+    s.textFragment    = loadShader("../shaders/text_fragment.glsl");
+    s.overlayVertex   = loadShader("../shaders/overlay_vertex.glsl");
+    s.overlayFragment = loadShader("../shaders/overlay_fragment.glsl");
+    s.cullCompute     = loadShader("../shaders/cull_compute.glsl");
+    return s;
+}
+
+unsigned int create_shader_program(const std::string& vSrc,
+                                   const std::string& fSrc)
+{
+    return link_program({ compile_shader(vSrc, GL_VERTEX_SHADER),
+                          compile_shader(fSrc, GL_FRAGMENT_SHADER) });
+}
+
+// Returns 0 if compute shaders are unsupported or the shader fails to build
+unsigned int create_compute_program(const std::string& cSrc)
+{
+    if (!GLAD_GL_VERSION_4_3) return 0;
+
+    return link_program({ compile_shader(cSrc, GL_COMPUTE_SHADER) });
+}
+
+// Renders a fixed view with growing light counts, once with clustered
+// lighting and once looping over every light per fragment, and prints the
+// average frame time of each.
+template <class DrawFn>
+void run_light_benchmark(GLFWwindow*        window,
+                         ClusteredLighting& lighting,
+                         const BoundingBox& bbox,
+                         DrawFn             draw)
+{
+    const size_t lightCounts[] = { 0, 16, 64, 256, 1024, 4096 };
+    const int    warmupFrames  = 10;
+    const int    timedFrames   = 100;
+
+    glfwSwapInterval(0);
+    std::cout << "\nLight benchmark (" << timedFrames << " frames per run)\n"
+              << std::setw(8) << "lights" << std::setw(14) << "assign ms"
+              << std::setw(16) << "clustered ms" << std::setw(12)
+              << "naive ms" << std::setw(14) << "links/froxel" << '\n';
+
+    for (size_t count : lightCounts)
+    {
+        lighting.set_lights(generate_lights(count, bbox.min, bbox.max));
+
+        double frameMs[2]     = {};
+        double assignMs       = 0.0;
+        double linksPerFroxel = 0.0;
+        for (int clustered = 1; clustered >= 0; clustered--)
+        {
+            for (int i = 0; i < warmupFrames + timedFrames; i++)
+            {
+                if (i == warmupFrames) glFinish();
+                auto start = std::chrono::steady_clock::now();
+                draw(clustered == 1);
+                glfwSwapBuffers(window);
+                glFinish();
+                glfwPollEvents();
+                if (i < warmupFrames) continue;
+
+                frameMs[clustered] += std::chrono::duration<double, std::milli>(
+                                          std::chrono::steady_clock::now() -
+                                          start)
+                                          .count();
+                // Only the clustered pass assigns lights to froxels
+                if (clustered == 1) assignMs += lighting.AssignMs;
+            }
+            if (clustered == 1)
+                linksPerFroxel = double(lighting.AssignedLinks) /
+                                 ClusteredLighting::CLUSTER_COUNT;
+        }
+
+        std::cout << std::fixed << std::setprecision(3) << std::setw(8)
+                  << count << std::setw(14) << assignMs / timedFrames
+                  << std::setw(16) << frameMs[1] / timedFrames << std::setw(12)
+                  << frameMs[0] / timedFrames << std::setw(14)
+                  << linksPerFroxel << '\n';
+    }
+}
+
+// Casts primary rays over a 1024x576 view from the camera, as single rays
+// and as 2x2 packets, and prints the throughput of each
+void run_bvh_benchmark(const SceneBvh& bvh,
+                       const Camera&   cam,
+                       float           fov,
+                       ThreadPool&     pool)
+{
+    const int width = 1024, height = 576, passes = 5;
+    float     tanY = std::tan(fov * 0.5f);
+    float     tanX = tanY * float(width) / float(height);
+
+    auto ray_dir = [&](int x, int y)
+    {
+        float sx = (2.0f * (x + 0.5f) / width - 1.0f) * tanX;
+        float sy = (1.0f - 2.0f * (y + 0.5f) / height) * tanY;
+        return glm::normalize(cam.Front + cam.Right * sx + cam.Up * sy);
+    };
+
+    std::cout << "\nBVH: " << bvh.triangle_count() << " triangles, "
+              << bvh.node_count() << " nodes, built in " << std::fixed
+              << std::setprecision(2) << bvh.BuildMs << " ms\n";
+
+    for (int packets = 0; packets < 2; packets++)
+    {
+        std::atomic<size_t> hits{ 0 };
+        auto start = std::chrono::steady_clock::now();
+        for (int pass = 0; pass < passes; pass++)
+        {
+            // Rows are taken in pairs so packets can cover 2x2 pixels
+            pool.parallel_for(
+                height / 2,
+                4,
+                [&](size_t begin, size_t end)
+                {
+                    size_t found = 0;
+                    for (size_t row = begin; row < end; row++)
+                        for (int x = 0; x < width; x += 2)
+                        {
+                            int y = int(row) * 2;
+                            if (packets)
+                            {
+                                glm::vec3 d[4] = { ray_dir(x, y),
+                                                   ray_dir(x + 1, y),
+                                                   ray_dir(x, y + 1),
+                                                   ray_dir(x + 1, y + 1) };
+                                RayPacket p;
+                                p.ox   = Lanes4(cam.Position.x);
+                                p.oy   = Lanes4(cam.Position.y);
+                                p.oz   = Lanes4(cam.Position.z);
+                                p.dx   = Lanes4(d[0].x, d[1].x, d[2].x, d[3].x);
+                                p.dy   = Lanes4(d[0].y, d[1].y, d[2].y, d[3].y);
+                                p.dz   = Lanes4(d[0].z, d[1].z, d[2].z, d[3].z);
+                                p.tMax = Lanes4(FLT_MAX);
+                                RayHit h[4];
+                                bvh.intersect4(p, h);
+                                for (const RayHit& hit : h)
+                                    found += hit.valid();
+                                continue;
+                            }
+                            for (int i = 0; i < 4; i++)
+                            {
+                                RayHit hit;
+                                found += bvh.intersect(cam.Position,
+                                                       ray_dir(x + i % 2, y + i / 2),
+                                                       FLT_MAX,
+                                                       hit);
+                            }
+                        }
+                    hits += found;
+                });
+        }
+        double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+        double rays = double(width) * height * passes;
+        std::cout << (packets ? "2x2 packets: " : "single rays: ")
+                  << rays / seconds / 1e6 << " Mrays/s on "
+                  << pool.size() + 1 << " threads, " << std::setprecision(1)
+                  << 100.0 * hits / rays << "% hit\n"
+                  << std::setprecision(2);
+    }
+}
+
+// Orbits the camera one step per frame as synthetic input, sampled just
+// before drawing, with the default queueing and then with low-latency
+// pacing, and prints the input-to-photon percentiles of each
+template <class DrawFn>
+void run_latency_benchmark(GLFWwindow* window, int framesInFlight, DrawFn draw)
+{
+    const int warmupFrames = 60;
+    const int timedFrames  = int(LatencyTracker::WINDOW);
+    Camera    start        = camera;
+
+    std::cout << "\nLatency benchmark (" << timedFrames
+              << " frames per run, ms)\n"
+              << std::setw(22) << "pacing" << std::setw(8) << "fps"
+              << std::setw(10) << "submit" << std::setw(8) << "p50"
+              << std::setw(8) << "p95" << std::setw(8) << "p99" << '\n';
+
+    for (int low = 0; low <= 1; low++)
+    {
+        LatencyTracker latency;
+        latency.init(glfwGetTime());
+        latency.FrameLimit = low ? framesInFlight : 0;
+        camera             = start;
+        double t0          = 0.0;
+        for (int i = 0; i < warmupFrames + timedFrames; i++)
+        {
+            if (i == warmupFrames)
+            {
+                latency.reset();
+                t0 = glfwGetTime();
+            }
+            if (latency.FrameLimit > 0)
+                latency.wait_for_frames(latency.FrameLimit);
+            glfwPollEvents();
+
+            double input = glfwGetTime();
+            camera.orbit(1.0f, 0.0f);
+            draw();
+            double submit = glfwGetTime();
+            glfwSwapBuffers(window);
+            latency.frame_swapped(input, submit, glfwGetTime());
+        }
+        double fps = timedFrames / (glfwGetTime() - t0);
+        latency.wait_for_frames(1);
+
+        LatencyPercentiles submit = latency.submit_latency();
+        LatencyPercentiles photon = latency.photon_latency();
+        std::string        pacing =
+            low ? "low latency (" + std::to_string(framesInFlight) + ")"
+                : "queued";
+        std::cout << std::fixed << std::setprecision(2) << std::setw(22)
+                  << pacing << std::setw(8) << std::setprecision(1) << fps
+                  << std::setprecision(2) << std::setw(10) << submit.p50
+                  << std::setw(8) << photon.p50 << std::setw(8) << photon.p95
+                  << std::setw(8) << photon.p99 << '\n';
+        latency.release();
+    }
+    camera = start;
+}
+
+// Renders `frames` views along `path` (an orbit of the camera around its
+// SceneCenter when empty) into the exporter and reports throughput
+template <class DrawFn>
+void run_export(FrameExporter&                exporter,
+                Camera&                       cam,
+                const std::vector<CameraKey>& path,
+                size_t                        frames,
+                DrawFn                        draw)
+{
+    glm::vec3 start = cam.Position;
+
+    std::cout << "Exporting " << frames << " frames at " << exporter.width()
+              << "x" << exporter.height() << '\n';
+    auto begin = std::chrono::steady_clock::now();
+    auto last  = begin;
+    for (size_t i = 0; i < frames; i++)
+    {
+        CameraKey key =
+            export_camera_key(path, cam.SceneCenter, start, i, frames);
+        cam.Position = key.position;
+        cam.set_front(key.target - key.position);
+
+        exporter.begin_frame();
+        draw(cam.get_view_matrix());
+        exporter.end_frame();
+        glfwPollEvents();
+
+        auto now = std::chrono::steady_clock::now();
+        if (std::chrono::duration<double>(now - last).count() >= 1.0 ||
+            i + 1 == frames)
+        {
+            double seconds = std::chrono::duration<double>(now - begin).count();
+            std::cout << "  frame " << i + 1 << "/" << frames << ", "
+                      << std::fixed << std::setprecision(1)
+                      << (i + 1) / seconds << " fps, encoder queue "
+                      << exporter.queue_depth() << '\n';
+            last = now;
+        }
+    }
+    exporter.finish();
+
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - begin)
+                         .count();
+    std::cout << "Exported " << exporter.FramesCaptured << " frames in "
+              << std::setprecision(2) << seconds << " s ("
+              << std::setprecision(1) << exporter.FramesCaptured / seconds
+              << " fps sustained, max encoder queue "
+              << exporter.MaxQueueDepth << ")\n";
+}
+
+// Renders one thumbnail per model with the auto-framing of the interactive
+// view. Models are imported and flattened on the pool a few ahead of the
+// model being drawn, and thumbnails are read back and written through a
+// FrameExporter, so the GL thread only uploads and draws.
+int run_thumbnails(const Options& opts, unsigned int shader, ThreadPool& pool)
+{
+    std::vector<std::string> paths = collect_model_paths(opts.thumbnailInput);
+    if (paths.empty())
+    {
+        std::cerr << "No models found in " << opts.thumbnailInput << '\n';
+        return -1;
+    }
+
+    FrameExporter exporter;
+    if (!exporter.init(opts.thumbnailSize,
+                       opts.thumbnailSize,
+                       ImageFormat::PNG,
+                       opts.thumbnailDir,
+                       pool))
+        return -1;
+
+    GeometryPages pages;
+    glEnable(GL_DEPTH_TEST);
+
+    // Fixed shading state: headlight, no textures or point lights. The
+    // samplers still get distinct units so their types never clash.
+    glUseProgram(shader);
+    glUniform1i(glGetUniformLocation(shader, "useShading"), 1);
+    glUniform1i(glGetUniformLocation(shader, "useRandomColor"), 0);
+    glUniform3f(glGetUniformLocation(shader, "baseColor"), 0.3, 0.6, 1.0);
+    glUniform1i(glGetUniformLocation(shader, "useDiffuseMap"), 0);
+    glUniform1i(glGetUniformLocation(shader, "useNormalMap"), 0);
+    glUniform1i(glGetUniformLocation(shader, "lightCount"), 0);
+    glUniform1i(glGetUniformLocation(shader, "useClustering"), 0);
+    glUniform1i(glGetUniformLocation(shader, "lightData"), 1);
+    glUniform1i(glGetUniformLocation(shader, "lightGrid"), 2);
+    glUniform1i(glGetUniformLocation(shader, "lightIndices"), 3);
+    glUniform1i(glGetUniformLocation(shader, "diffuseMap"), 4);
+    glUniform1i(glGetUniformLocation(shader, "normalMap"), 5);
+    glm::mat4 model(1.0f);
+    glUniformMatrix4fv(
+        glGetUniformLocation(shader, "model"), 1, GL_FALSE, &model[0][0]);
+
+    const float verticalFov = glm::radians(45.0f);
+    const size_t lookahead  = pool.size() + 1;
+
+    std::deque<std::future<LoadedModel>> loading;
+    size_t                               next = 0;
+    auto                                 fill = [&]
+    {
+        while (next < paths.size() && loading.size() < lookahead)
+        {
+            const std::string& path = paths[next++];
+            loading.push_back(pool.submit(
+                [&opts, &pool, path]
+                { return load_model_geometry(path, opts, pool); }));
+        }
+    };
+
+    size_t rendered = 0, failed = 0, triangles = 0;
+    double loadMs = 0.0;
+    auto   start  = std::chrono::steady_clock::now();
+    fill();
+    while (!loading.empty())
+    {
+        LoadedModel m = loading.front().get();
+        loading.pop_front();
+        fill();
+
+        if (!m.error.empty())
+        {
+            std::cerr << "Skipping " << m.path << ": " << m.error << '\n';
+            failed++;
+            continue;
+        }
+
+        size_t vertexCount = m.vertices.size() / m.fmt.stride;
+        pages.upload(
+            m.vertices,
+            m.fmt,
+            plan_pages({ DrawRange{ 0, vertexCount, 0 } },
+                       GeometryPages::page_vertices(opts.pageMB << 20, m.fmt)),
+            0,
+            GL_STREAM_DRAW);
+
+        glm::vec3 center    = (m.boxMin + m.boxMax) * 0.5f;
+        glm::vec3 size      = m.boxMax - m.boxMin;
+        float     maxExtent = std::max({ size.x, size.y, size.z });
+        float     distance  = framing_distance(maxExtent, verticalFov, 1.0f);
+        float     nearPlane, farPlane;
+        clip_planes(distance, nearPlane, farPlane);
+
+        glm::vec3 eye  = center + glm::vec3(0.0f, 0.0f, 1.0f) * distance;
+        glm::mat4 view = glm::lookAt(eye, center, glm::vec3(0, 1, 0));
+        glm::mat4 proj = glm::perspective(
+            verticalFov, /*aspect=*/1.0f, nearPlane, farPlane);
+        glUniformMatrix4fv(
+            glGetUniformLocation(shader, "view"), 1, GL_FALSE, &view[0][0]);
+        glUniformMatrix4fv(glGetUniformLocation(shader, "projection"),
+                           1,
+                           GL_FALSE,
+                           &proj[0][0]);
+        glUniform3fv(glGetUniformLocation(shader, "lightPos"), 1, &eye[0]);
+        glUniform3fv(glGetUniformLocation(shader, "viewPos"), 1, &eye[0]);
+
+        exporter.begin_frame();
+        glClearColor(0.1, 0.1, 0.1, 1);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        for (size_t p = 0; p < pages.size(); p++)
+        {
+            pages.bind(p);
+            glDrawArrays(GL_TRIANGLES, 0, GLsizei(pages.span(p).count));
+        }
+        exporter.end_frame(thumbnail_name(m.path, opts.thumbnailInput));
+
+        rendered++;
+        triangles += vertexCount / 3;
+        loadMs += m.loadMs;
+        if (rendered % 100 == 0)
+            std::cout << "  " << rendered << "/" << paths.size()
+                      << " thumbnails, encoder queue "
+                      << exporter.queue_depth() << '\n';
+    }
+    exporter.finish();
+
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    std::cout << "Rendered " << rendered << " thumbnails (" << failed
+              << " failed) in " << std::fixed << std::setprecision(2)
+              << seconds << " s: " << rendered / seconds << " models/s, "
+              << triangles / seconds / 1e6 << " Mtris/s, "
+              << (rendered ? loadMs / rendered : 0.0)
+              << " ms average load on " << pool.size() << " workers\n";
+
+    pages.release();
+    return failed == paths.size() ? -1 : 0;
+}
+
+// Text of the debug overlay. The loop compares it with the last rendered
+// overlay, so only lines that actually change cause a re-render.
+std::vector<OverlayLine> debug_overlay(const std::string&       pickInfo,
+                                       size_t                   totalVertices,
+                                       const char*              modelName,
+                                       const ClusteredLighting& lighting,
+                                       const TextureStreamer&   streamer,
+                                       const ClusterCuller&     culler,
+                                       const OcclusionBuffer*   occlusion,
+                                       const LatencyTracker&    latency)
+{
+    std::vector<OverlayLine> lines;
+    std::ostringstream       text;
+    auto                     add = [&](float y)
+    {
+        lines.push_back({ text.str(), y });
+        text.str("");
+    };
+
+    text << "FPS: " << std::fixed << std::setprecision(1) << currentFPS;
+    add(1150.0f);
+    text << "Pos: (" << std::fixed << std::setprecision(1)
+         << camera.Position.x << ", " << camera.Position.y << ", "
+         << camera.Position.z << ")";
+    add(1125.0f);
+    text << "Speed: " << std::fixed << std::setprecision(2)
+         << camera.get_current_speed();
+    add(1100.0f);
+
+    const char* modeNames[] = { "Shaded", "Wireframe", "Random" };
+    text << "Mode: " << modeNames[currentMode];
+    add(1075.0f);
+
+    // Info about model on screen like number of vertices etc.
+    text << "Vertices: " << totalVertices;
+    add(1050.0f);
+    text << "Model Name: " << modelName;
+    add(1025.0f);
+
+    text << "Culling: " << culler.path_name();
+    if (culler.ActivePath == ClusterCuller::CPU)
+        text << " (" << culler.VisibleClusters << "/"
+             << culler.cluster_count() << " clusters)";
+    else
+        text << " (" << culler.cluster_count() << " clusters)";
+    if (occlusion)
+        text << ", occlusion raster " << std::setprecision(2)
+             << occlusion->RasterMs << " ms, test " << culler.OcclusionTestMs
+             << " ms, " << std::setprecision(1)
+             << (culler.TestedTriangles
+                     ? 100.0 * culler.OccludedTriangles / culler.TestedTriangles
+                     : 0.0)
+             << "% triangles culled";
+    add(1000.0f);
+
+    text << "Lights: " << lighting.light_count() << " ("
+         << std::setprecision(2) << lighting.AssignMs << " ms assign)";
+    add(975.0f);
+    text << "Textures: " << streamer.full_res_count() << "/"
+         << streamer.texture_count() << " full res, " << std::setprecision(1)
+         << streamer.ResidentBytes / 1048576.0 << "/"
+         << streamer.TotalBytes / 1048576.0 << " MB (budget "
+         << (streamer.BudgetBytes >> 20) << "), queue "
+         << streamer.QueuedLevels;
+    add(950.0f);
+    text << "Pick: " << pickInfo;
+    add(925.0f);
+
+    LatencyPercentiles submit = latency.submit_latency();
+    LatencyPercentiles photon = latency.photon_latency();
+    text << "Latency: submit " << std::setprecision(1) << submit.p50
+         << " ms, GPU done p50/p95/p99 " << photon.p50 << "/" << photon.p95
+         << "/" << photon.p99 << " ms, ";
+    if (latency.FrameLimit > 0)
+        text << "low latency (" << latency.FrameLimit << " queued)";
+    else
+        text << "queued by the driver";
+    add(900.0f);
+
+    // Controls help
+    lines.push_back({ "Controls:", 875.0f, 0.4f, glm::vec3(0.8f) });
+    const char* controls[] = { "WASD - Move",
+                               "Space/Shift - Up/Down",
+                               "Mouse - Look",
+                               "Tab - Mode",
+                               "E - Debug",
+                               "LMB - Pick, double-click - Focus",
+                               "RMB drag - Orbit" };
+    float y = 845.0f;
+    for (const char* control : controls)
+    {
+        lines.push_back({ control, y, 0.3f, glm::vec3(0.7f) });
+        y -= 25.0f;
+    }
+    return lines;
+}
+
 // Updated main function
 int main(int argc, char** argv)
 {
+    StartupTimeline timeline;
+
+    // Workers are started with the original command line
+    std::vector<std::string> launchArgs(argv, argv + argc);
+
+    timeline.phase("GLUT init", [&] { glutInit(&argc, argv); });
 
-    glutInit(&argc, argv);
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, /*value=*/4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, /*value=*/2);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    Options opts;
+    if (!parse_options(argc, argv, opts))
+    {
+        print_usage(argv[0]);
+        return -1;
+    }
+    bool batchMode = !opts.thumbnailInput.empty();
+    bool distributed = !opts.exportDir.empty() &&
+                       (opts.workers > 0 || !opts.workerSocket.empty());
+
+    std::string modelPath = opts.modelPath;
+
+    // Model data, filled in by the loading task below. Declared before the
+    // pool, so an early return joins the workers while it is still alive.
+    VertexFormat               fmt;
+    std::vector<float>         vertices;
+    std::vector<DrawRange>     ranges;
+    std::vector<MeshInstance>  instances;
+    std::vector<MaterialPaths> materialPaths;
+    std::string                cachePath = modelPath + ".meshcache";
+    MeshCacheKey               cacheKey;
+    bool                       cached = false;
+    Assimp::Importer           importer;
+    const aiScene*             scene = nullptr;
+    PositionStreams            positions; // SoA copy for the CPU passes
+    BoundingBox                bbox;
+    SceneBvh                   bvh;       // picking and camera collision
+    std::vector<PageSpan>      pageSpans;
+    std::vector<Cluster>       clusters;
+
+    ThreadPool pool;
+
+    // Startup graph: everything that needs no GL context runs on the pool
+    // while this thread creates the window and compiles shaders. Results
+    // are joined here, where the GL uploads happen in order.
+    auto shaderSources = pool.submit(
+        [&] { return timeline.phase("Shader file I/O", load_shader_sources); });
+
+    std::future<std::vector<GlyphBitmap>> glyphs;
+    if (!batchMode)
+        glyphs = pool.submit(
+            [&]
+            {
+                return timeline.phase("Glyph rasterisation",
+                                      []
+                                      {
+                                          return rasterize_font(
+                                              "../assets/sample.ttf");
+                                      });
+            });
+
+    // Welding and normal generation run on the pool unless --assimp-post
+    // asks for Assimp's single-threaded steps
+    unsigned int importFlags = aiProcess_Triangulate | aiProcess_FlipUVs;
+    if (opts.assimpPost)
+        importFlags |= aiProcess_GenNormals | aiProcess_JoinIdenticalVertices;
+
+    // Import (or the mesh cache), extraction, bounds, BVH and clusters.
+    // Returns false if the model cannot be loaded.
+    auto load_model = [&]() -> bool
+    {
+        // Workers map the geometry the coordinator cached instead of
+        // importing
+        cacheKey = mesh_cache_key(modelPath, opts);
+        if (!opts.workerSocket.empty())
+            cached = timeline.phase("Mesh cache read",
+                                    [&]
+                                    {
+                                        return read_mesh_cache(cachePath,
+                                                               cacheKey,
+                                                               fmt,
+                                                               vertices,
+                                                               ranges,
+                                                               instances,
+                                                               materialPaths);
+                                    });
+
+        if (!cached)
+        {
+            scene = timeline.phase("Assimp import",
+                                   [&]
+                                   {
+                                       return importer.ReadFile(modelPath,
+                                                                importFlags);
+                                   });
+            if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
+                !scene->mRootNode)
+            {
+                std::cerr << "ERROR::ASSIMP::" << importer.GetErrorString()
+                          << '\n';
+                return false;
+            }
+
+            if (!opts.assimpPost)
+            {
+                PostProcessStats post = timeline.phase(
+                    "Weld + normals",
+                    [&]
+                    {
+                        return post_process_scene(
+                            scene, opts.weldEpsilon, opts.normals, pool);
+                    });
+                std::cout << "Welded " << post.verticesBefore << " -> "
+                          << post.verticesAfter << " vertices in "
+                          << post.weldMs << " ms, normals for "
+                          << post.meshesNormals << " meshes in "
+                          << post.normalsMs << " ms\n";
+                if (opts.comparePost) compare_with_assimp(modelPath, post);
+            }
+
+            // Extract vertices
+            fmt = analyzeScene(scene);
+            std::cout << "Number of meshes: " << scene->mNumMeshes << '\n';
+            auto extractStart = std::chrono::steady_clock::now();
+            timeline.phase("Extraction",
+                           [&]
+                           {
+                               extractVertices(
+                                   scene, fmt, vertices, ranges, instances);
+                           });
+            double extractMs =
+                std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - extractStart)
+                    .count();
+            std::cout << "Extracted " << ranges.size() << " unique meshes, "
+                      << instances.size() << " instances in " << extractMs
+                      << " ms\n";
+
+            if (opts.compareExpanded)
+            {
+                auto               start    = std::chrono::steady_clock::now();
+                std::vector<float> expanded =
+                    expandInstances(vertices, fmt, ranges, instances);
+                double expandMs =
+                    std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+                std::cout << "Expanded soup: " << expanded.size() / fmt.stride
+                          << " vertices in " << extractMs + expandMs
+                          << " ms including extraction\n";
+            }
+        }
+
+        timeline.phase("Bounds + BVH",
+                       [&]
+                       {
+                           positions = fmt.ops->positions(vertices, pool);
+                           sceneBounds(positions,
+                                       ranges,
+                                       instances,
+                                       bbox.min,
+                                       bbox.max);
+                           bvh.build(positions, ranges, instances, pool);
+                       });
+        std::cout << "BVH built in " << bvh.BuildMs << " ms ("
+                  << bvh.node_count() << " nodes)\n";
+
+        timeline.phase(
+            "Pages + clusters",
+            [&]
+            {
+                pageSpans = plan_pages(
+                    ranges,
+                    GeometryPages::page_vertices(opts.pageMB << 20, fmt));
+                clusters =
+                    build_clusters(positions, ranges, instances, pageSpans);
+            });
+        return true;
+    };
+    std::future<bool> modelLoaded;
+    if (!batchMode) modelLoaded = pool.submit(load_model);
 
-    GLFWwindow* window = glfwCreateWindow(
-        /*width=*/1920,
-        /*height=*/1080,
-        /*title=*/"Rasterizer",
-        /*monitor=*/nullptr,
-        /*share=*/nullptr);
+    GLFWwindow* window = timeline.phase(
+        "Window + context",
+        [&]
+        {
+            glfwInit();
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, /*value=*/4);
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, /*value=*/2);
+            glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+            // Batch rendering only needs the context, never the window
+            if (batchMode || distributed)
+                glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+            return glfwCreateWindow(/*width=*/1920,
+                                    /*height=*/1080,
+                                    /*title=*/"Rasterizer",
+                                    /*monitor=*/nullptr,
+                                    /*share=*/nullptr);
+        });
     if (!window)
     {
         std::cerr << "Failed to create GLFW window\n";
@@ -386,30 +1274,53 @@ int main(int argc, char** argv)
     }
 
     glfwMakeContextCurrent(window);
+    glfwSwapInterval(opts.swapInterval);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     glfwSetScrollCallback(window, scroll_callback);
+    glfwSetMouseButtonCallback(window, mouse_button_callback);
+    glfwSetWindowRefreshCallback(window, window_refresh_callback);
     showDebugInfo = false;
     std::cout << "Debug info enabled. Rendering text to screen." << '\n';
 
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    if (!timeline.phase("GLAD load",
+                        []
+                        {
+                            return gladLoadGLLoader(
+                                (GLADloadproc)glfwGetProcAddress);
+                        }))
     {
         std::cerr << "Failed to initialize GLAD\n";
         return -1;
     }
 
-    if (argc < 2)
+    // Vertex arrays without an instance buffer (bounding box, thumbnails)
+    // read the identity as their instance transform
+    for (int column = 0; column < 4; column++)
+        glVertexAttrib4f(3 + column,
+                         column == 0,
+                         column == 1,
+                         column == 2,
+                         column == 3);
+
+    ShaderSources shaders = shaderSources.get();
+    auto          mesh_shader = timeline.phase(
+        "Shader compile",
+        [&]
+        {
+            return create_shader_program(shaders.meshVertex,
+                                         shaders.meshFragment);
+        });
+
+    if (batchMode)
     {
-        std::cerr << "Usage: " << argv[0] << " <path_to_model.obj>" << '\n';
-        return -1;
+        timeline.print("Startup");
+        int result = run_thumbnails(opts, mesh_shader, pool);
+        glfwTerminate();
+        return result;
     }
 
-    std::string modelPath = argv[1];
-
-    auto mesh_shader = create_shader_program(
-        "../shaders/vertex.glsl", "../shaders/fragment.glsl");
-
     glGenVertexArrays(1, &textVAO);
     glGenBuffers(1, &textVBO);
     glBindVertexArray(textVAO);
@@ -422,42 +1333,45 @@ int main(int argc, char** argv)
 
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    load_font("../assets/sample.ttf");
-    auto text_shader = create_shader_program(
-        "../shaders/text_vertex.glsl", "../shaders/text_fragment.glsl");
-
-    Assimp::Importer importer;
-    const aiScene*   scene = importer.ReadFile(
-        modelPath,
-        aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenNormals |
-            aiProcess_JoinIdenticalVertices);
-
-    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+    unsigned int text_shader = 0, overlay_shader = 0;
+    timeline.phase("Overlay shader compile",
+                   [&]
+                   {
+                       text_shader    = create_shader_program(
+                           shaders.textVertex, shaders.textFragment);
+                       overlay_shader = create_shader_program(
+                           shaders.overlayVertex, shaders.overlayFragment);
+                   });
+
+    std::vector<GlyphBitmap> glyphBitmaps = glyphs.get();
+    timeline.phase("Glyph upload", [&] { upload_font(glyphBitmaps); });
+
+    // The rest needs the model
+    bool modelOk =
+        timeline.phase("Wait for model", [&] { return modelLoaded.get(); });
+    if (!modelOk)
     {
-        std::cerr << "ERROR::ASSIMP::" << importer.GetErrorString() << '\n';
+        glfwTerminate();
         return -1;
     }
 
-    // Extract vertices
-    std::vector<float> vertices;
-    std::cout << "Number of meshes: " << scene->mNumMeshes << '\n';
-    extractVertices(scene->mRootNode, scene, vertices);
-
-    int totalVertices = vertices.size() / 6; // 6 floats per vertex (pos + normal)
+    size_t totalVertices = vertices.size() / fmt.stride;
+    size_t drawnVertices = expandedVertexCount(ranges, instances);
     std::cout << "Total vertices extracted: " << totalVertices << '\n';
-    std::cout << "Total triangles: " << totalVertices / 3 << '\n';
+    std::cout << "Total triangles: " << drawnVertices / 3 << " drawn, "
+              << totalVertices / 3 << " stored\n";
 
-    // Compute bounding box from position data only
-    BoundingBox bbox;
-    bbox.min = glm::vec3(FLT_MAX);
-    bbox.max = glm::vec3(-FLT_MAX);
+    double vertexMB   = vertices.size() * sizeof(float) / 1048576.0;
+    double instanceMB = instances.size() * sizeof(glm::mat4) / 1048576.0;
+    double expandedMB = drawnVertices * fmt.stride * sizeof(float) /
+                        1048576.0;
+    std::cout << "Geometry: " << vertexMB << " MB vertices + " << instanceMB
+              << " MB transforms, " << expandedMB
+              << " MB fully expanded (saved "
+              << expandedMB - vertexMB - instanceMB << " MB)\n";
 
-    for (size_t i = 0; i < vertices.size(); i += 6)
-    { // Every 6 floats, take first 3
-        glm::vec3 v(vertices[i], vertices[i + 1], vertices[i + 2]);
-        bbox.min = glm::min(bbox.min, v);
-        bbox.max = glm::max(bbox.max, v);
-    }
+    sceneBvh      = &bvh;
+    collideCamera = opts.collide;
 
     glm::vec3 center    = (bbox.min + bbox.max) * 0.5f;
     glm::vec3 size      = bbox.max - bbox.min;
@@ -466,29 +1380,12 @@ int main(int argc, char** argv)
     // Improved camera positioning with better distance calculation
     float verticalFov = glm::radians(45.0f);
     float aspectRatio = 1600.0f / 1200.0f;
-
-    // Calculate distance to fit the entire bounding box in view
-    // Account for both vertical and horizontal FOV
-    float verticalDistance = (maxExtent * 0.5f) / std::tan(verticalFov * 0.5f);
-    float horizontalFov    = 2.0f *
-                          std::atan(std::tan(verticalFov * 0.5f) * aspectRatio);
-    float horizontalDistance = (maxExtent * 0.5f) /
-                               std::tan(horizontalFov * 0.5f);
-
-    // Use the larger distance to ensure the object fits in both dimensions
-    float distance = std::max(verticalDistance, horizontalDistance);
-
-    // Add some padding (multiply by 1.5) to ensure the object is
-    // comfortably in view
-    distance *= 1.5f;
-
-    // Ensure minimum distance to avoid being too close
-    distance = std::max(distance, maxExtent * 2.0f);
+    float distance    = framing_distance(maxExtent, verticalFov, aspectRatio);
 
     glm::vec3 camPos = center + glm::vec3(0.0f, 0.0f, 1.0f) * distance;
 
-    camera       = Camera(camPos, glm::vec3(0, 1, 0), -90.f, 0.f);
-    camera.Front = glm::normalize(center - camPos);
+    camera = Camera(camPos, glm::vec3(0, 1, 0), -90.f, 0.f);
+    camera.set_front(center - camPos);
 
     // Set scene parameters for adaptive camera speed
     camera.set_scene_params(center, maxExtent);
@@ -510,28 +1407,30 @@ int main(int argc, char** argv)
     std::cout << "Mouse - Look around" << '\n';
     std::cout << "Tab - Switch render modes (Shaded/Wireframe/Random)" << '\n';
     std::cout << "E - Toggle debug info" << '\n';
+    std::cout << "Left click - Pick, double-click - Focus" << '\n';
+    std::cout << "Right drag - Orbit focus point" << '\n';
     std::cout << "Q - Quit" << '\n';
 
-    // Setup for main model
-    unsigned int VAO, VBO, bboxVAO, bboxVBO;
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glBindVertexArray(VAO);
-
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER,
-                 vertices.size() * sizeof(float),
-                 vertices.data(),
-                 GL_STATIC_DRAW);
-
-    // Position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), nullptr);
-    glEnableVertexAttribArray(0);
-
-    // Normal attribute
-    glVertexAttribPointer(
-        1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
+    // Instance transforms, one mat4 (attributes 3-6) per instance. Draws
+    // pick theirs with baseInstance.
+    unsigned int bboxVAO, bboxVBO, instanceVBO;
+    GeometryPages pages;
+    timeline.phase("Geometry upload",
+                   [&]
+                   {
+                       glGenBuffers(1, &instanceVBO);
+                       glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+                       glBufferData(GL_ARRAY_BUFFER,
+                                    instances.size() * sizeof(MeshInstance),
+                                    instances.data(),
+                                    GL_STATIC_DRAW);
+
+                       // The soup in size-bounded buffer pages, each with
+                       // the layout's attributes and the instance transforms
+                       pages.upload(vertices, fmt, pageSpans, instanceVBO);
+                   });
+    std::cout << "Uploaded " << pages.Bytes / 1048576.0 << " MB of vertices in "
+              << pages.size() << " pages of up to " << opts.pageMB << " MB\n";
 
     // Bounding box setup
     std::vector<float> bboxVertices = {
@@ -562,55 +1461,127 @@ int main(int argc, char** argv)
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), nullptr);
     glEnableVertexAttribArray(0);
 
+    // Cluster culling
+    // Occluders are picked from the clusters while positions are at hand.
+    // The buffer is tested on the CPU culling path only, so `auto` picks
+    // that path when it is enabled.
+    OcclusionBuffer occlusion;
+    bool            useOcclusion = opts.occlusion &&
+                        (opts.cullMode == CullMode::AUTO ||
+                         opts.cullMode == CullMode::CPU);
+    if (opts.occlusion && !useOcclusion)
+        std::cerr << "Occlusion culling needs --cull=cpu or auto, ignored\n";
+    if (useOcclusion)
+        occlusion.init(int(opts.occlusionWidth),
+                       int(opts.occlusionHeight),
+                       clusters,
+                       positions,
+                       pageSpans,
+                       instances);
+    positions = PositionStreams{};
+
+    bool allowGpu = (opts.cullMode == CullMode::AUTO && !useOcclusion) ||
+                    opts.cullMode == CullMode::GPU;
+    bool allowCpu = opts.cullMode != CullMode::OFF;
+    unsigned int cull_shader = 0;
+    if (allowGpu)
+        cull_shader = timeline.phase(
+            "Cull shader compile",
+            [&] { return create_compute_program(shaders.cullCompute); });
+    if (opts.cullMode == CullMode::GPU && cull_shader == 0)
+        std::cerr << "GPU culling unavailable, falling back to CPU\n";
+
+    ClusterCuller culler;
+    culler.ConeCulling = opts.coneCull;
+    culler.init(clusters, cull_shader, allowGpu, allowCpu);
+    if (useOcclusion && culler.ActivePath == ClusterCuller::CPU)
+        culler.Occluded = [&](const Cluster& c)
+        {
+            return occlusion.occluded(glm::vec3(c.boxMin), glm::vec3(c.boxMax));
+        };
+
     glEnable(GL_DEPTH_TEST);
 
+    // Back-facing clusters are only dropped when faces are culled too,
+    // otherwise the result would depend on the culling path
+    if (opts.coneCull) glEnable(GL_CULL_FACE);
+
+    // Materials. Textures are converted to KTX2 on first load, then their
+    // mips stream in within the budget.
+    TextureStreamer streamer;
+    streamer.BudgetBytes = opts.textureBudgetMB << 20;
+    std::vector<Material> materials;
+    timeline.phase("Materials",
+                   [&]
+                   {
+                       if (fmt.hasTexCoords && cached)
+                           materials = add_materials(materialPaths, streamer);
+                       else if (fmt.hasTexCoords)
+                           materials = load_materials(scene,
+                                                      modelPath,
+                                                      pool,
+                                                      streamer,
+                                                      &materialPaths);
+                   });
+    bool coordinator = distributed && opts.workerSocket.empty();
+    if (coordinator &&
+        !write_mesh_cache(cachePath,
+                          cacheKey,
+                          fmt,
+                          vertices,
+                          ranges,
+                          instances,
+                          materialPaths))
+        std::cerr << "Failed to write " << cachePath << '\n';
+
+    ClusteredLighting lighting;
+    lighting.init();
+    lighting.set_lights(generate_lights(opts.lightCount, bbox.min, bbox.max));
+
     // Improved projection matrix with dynamic near/far planes
-    float nearPlane = distance * 0.01F; // 1% of distance
-    float farPlane  = distance * 10.0F; // 10x distance
+    float nearPlane, farPlane;
+    clip_planes(distance, nearPlane, farPlane);
 
-    // Ensure reasonable bounds
-    nearPlane = std::max(nearPlane, 0.001F);
-    farPlane  = std::max(farPlane, nearPlane * 1000.0F);
+    // Offscreen target size while exporting, 0 for the window
+    int renderWidth = 0, renderHeight = 0;
 
-    // FPS calculation variables
-    double fpsTimer   = 0.0;
-    auto   frameCount = 0;
+    // Strip of the frame a worker renders: applied after the projection,
+    // and the strip's position for the light grid lookup
+    glm::mat4 tileMatrix(1.0f);
+    glm::vec2 tileOffset(0.0f);
 
-    while (!glfwWindowShouldClose(window))
+    // Clears the frame and draws the model in the current mode
+    auto draw_scene = [&](const glm::mat4& view,
+                          const glm::mat4& proj,
+                          bool             clusteredLights)
     {
-        auto time = glfwGetTime();
-        deltaTime = time - lastFrame;
-        lastFrame = time;
-
-        // Calculate FPS
-        fpsTimer += deltaTime;
-        frameCount++;
-        if (fpsTimer >= 1.0)
-        {
-            currentFPS = frameCount / fpsTimer;
-            frameCount = 0;
-            fpsTimer   = 0.0;
-        }
-
-        process_input(window);
-
         glClearColor(0.1, 0.1, 0.1, 1);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glUseProgram(mesh_shader);
         glm::mat4 model = glm::mat4(1.0);
-        glm::mat4 view  = camera.get_view_matrix();
-        glm::mat4 proj  = glm::perspective(
-            verticalFov, 16.0F / 9.0F, nearPlane, farPlane);
 
-        glUniformMatrix4fv(
-            glGetUniformLocation(mesh_shader, "model"), 1, GL_FALSE, &model[0][0]);
-        glUniformMatrix4fv(
-            glGetUniformLocation(mesh_shader, "view"), 1, GL_FALSE, &view[0][0]);
+        glm::mat4 tileProj = tileMatrix * proj;
+        if (culler.Occluded) occlusion.render(tileProj * view, pool);
+        culler.cull(tileProj * view, camera.Position);
+        if (culler.Occluded)
+            occlusion.record(culler.OcclusionTestMs,
+                             culler.TestedTriangles,
+                             culler.OccludedTriangles);
+
+        glUseProgram(mesh_shader);
+
+        glUniformMatrix4fv(glGetUniformLocation(mesh_shader, "model"),
+                           1,
+                           GL_FALSE,
+                           &model[0][0]);
+        glUniformMatrix4fv(glGetUniformLocation(mesh_shader, "view"),
+                           1,
+                           GL_FALSE,
+                           &view[0][0]);
         glUniformMatrix4fv(glGetUniformLocation(mesh_shader, "projection"),
                            1,
                            GL_FALSE,
-                           &proj[0][0]);
+                           &tileProj[0][0]);
 
         // Set shading parameters based on current mode
         if (currentMode == SHADED)
@@ -622,6 +1593,15 @@ int main(int argc, char** argv)
                          1,
                          &camera.Position[0]);
             glUniform1i(glGetUniformLocation(mesh_shader, "useShading"), 1);
+
+            int fbWidth = renderWidth, fbHeight = renderHeight;
+            if (fbWidth == 0)
+                glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
+            // The naive loop reads every light and needs no froxel lists
+            if (clusteredLights)
+                lighting.update(view, proj, nearPlane, farPlane, pool);
+            lighting.bind(
+                mesh_shader, fbWidth, fbHeight, clusteredLights, tileOffset);
         }
         else
         {
@@ -636,8 +1616,37 @@ int main(int argc, char** argv)
             glUniform1i(glGetUniformLocation(mesh_shader, "useRandomColor"), 0);
             glUniform3f(
                 glGetUniformLocation(mesh_shader, "baseColor"), 0.3, 0.6, 1.0);
-            glBindVertexArray(VAO);
-            glDrawArrays(GL_TRIANGLES, 0, totalVertices);
+            glUniform1i(glGetUniformLocation(mesh_shader, "diffuseMap"), 4);
+            glUniform1i(glGetUniformLocation(mesh_shader, "normalMap"), 5);
+            for (size_t b = 0; b < culler.batch_count(); b++)
+            {
+                unsigned int page = culler.batch_page(b);
+                if (b == 0 || page != culler.batch_page(b - 1))
+                    pages.bind(page);
+
+                unsigned int m       = culler.batch_material(b);
+                int          diffuse = m < materials.size()
+                                           ? materials[m].diffuseTexture
+                                           : -1;
+                int          normal  = m < materials.size()
+                                           ? materials[m].normalTexture
+                                           : -1;
+                bool hasDiffuse = streamer.resident(diffuse);
+                bool hasNormal  = streamer.resident(normal);
+
+                glActiveTexture(GL_TEXTURE4);
+                glBindTexture(GL_TEXTURE_2D,
+                              hasDiffuse ? streamer.texture(diffuse) : 0);
+                glActiveTexture(GL_TEXTURE5);
+                glBindTexture(GL_TEXTURE_2D,
+                              hasNormal ? streamer.texture(normal) : 0);
+                glActiveTexture(GL_TEXTURE0);
+                glUniform1i(glGetUniformLocation(mesh_shader, "useDiffuseMap"),
+                            hasDiffuse ? 1 : 0);
+                glUniform1i(glGetUniformLocation(mesh_shader, "useNormalMap"),
+                            hasNormal ? 1 : 0);
+                culler.draw_batch(b);
+            }
             break;
 
         case WIREFRAME:
@@ -645,156 +1654,348 @@ int main(int argc, char** argv)
             glUniform1i(glGetUniformLocation(mesh_shader, "useRandomColor"), 0);
             glUniform3f(
                 glGetUniformLocation(mesh_shader, "baseColor"), 0.8, 0.8, 0.8);
-            glBindVertexArray(VAO);
-            glDrawArrays(GL_TRIANGLES, 0, totalVertices);
+            culler.draw([&](unsigned int page) { pages.bind(page); });
             glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
             break;
         case RANDOM:
             glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
             glUniform1i(glGetUniformLocation(mesh_shader, "useRandomColor"), 1);
-            glBindVertexArray(VAO);
-            glDrawArrays(GL_TRIANGLES, 0, totalVertices);
+            culler.draw([&](unsigned int page) { pages.bind(page); });
             break;
         }
+    };
+
+    // Benchmarks and exports never present, so their startup ends here
+    if (opts.benchLights || opts.benchBvh || opts.benchLatency ||
+        !opts.exportDir.empty())
+        timeline.print("Startup");
+
+    if (opts.benchLights)
+    {
+        glm::mat4 proj = glm::perspective(
+            verticalFov, 16.0F / 9.0F, nearPlane, farPlane);
+        run_light_benchmark(window,
+                            lighting,
+                            bbox,
+                            [&](bool clustered) {
+                                draw_scene(
+                                    camera.get_view_matrix(), proj, clustered);
+                            });
+        glfwTerminate();
+        return 0;
+    }
+
+    if (opts.benchBvh)
+    {
+        run_bvh_benchmark(bvh, camera, verticalFov, pool);
+        glfwTerminate();
+        return 0;
+    }
+
+    if (opts.benchLatency)
+    {
+        glm::mat4 proj = glm::perspective(
+            verticalFov, 16.0F / 9.0F, nearPlane, farPlane);
+        run_latency_benchmark(window,
+                              opts.framesInFlight,
+                              [&] {
+                                  draw_scene(
+                                      camera.get_view_matrix(), proj, true);
+                              });
+        glfwTerminate();
+        return 0;
+    }
+
+    if (!opts.exportDir.empty())
+    {
+        std::vector<CameraKey> path;
+        if (!opts.exportPath.empty() &&
+            !load_camera_path(opts.exportPath, path))
+            return -1;
+
+        if (coordinator)
+        {
+            int result = run_coordinator(opts, launchArgs, pool);
+            glfwTerminate();
+            return result;
+        }
+
+        // Let textures stream in fully so every frame sees the same data
+        do
+        {
+            streamer.update();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        } while (!streamer.settled());
+
+        // Workers render whole frames, or strips stitched by the coordinator
+        uint32_t tiles = distributed ? std::min(opts.exportTiles,
+                                                opts.exportHeight)
+                                     : 1;
+        uint32_t    tileRows = tile_height(opts.exportHeight, tiles);
+        ImageFormat format = tiles > 1       ? ImageFormat::RAW
+                             : opts.exportQoi ? ImageFormat::QOI
+                                              : ImageFormat::PNG;
+
+        FrameExporter exporter;
+        if (!exporter.init(
+                opts.exportWidth, tileRows, format, opts.exportDir, pool))
+            return -1;
+
+        renderWidth  = int(opts.exportWidth);
+        renderHeight = int(opts.exportHeight);
+        glm::mat4 proj = glm::perspective(verticalFov,
+                                          float(renderWidth) / renderHeight,
+                                          nearPlane,
+                                          farPlane);
+        if (distributed)
+        {
+            glm::vec3 start  = camera.Position;
+            int       result = run_worker(
+                opts.workerSocket,
+                [&](const WorkItem& item)
+                {
+                    CameraKey key = export_camera_key(path,
+                                                      camera.SceneCenter,
+                                                      start,
+                                                      item.frame,
+                                                      opts.exportFrames);
+                    camera.Position = key.position;
+                    camera.set_front(key.target - key.position);
+                    if (tiles > 1)
+                    {
+                        tileMatrix = tile_projection(
+                            opts.exportHeight, tileRows, item.tile);
+                        tileOffset = tile_offset(
+                            opts.exportHeight, tileRows, item.tile);
+                    }
+
+                    exporter.begin_frame();
+                    draw_scene(camera.get_view_matrix(), proj, true);
+                    exporter.end_frame(
+                        tiles > 1 ? tile_file_name(item.frame, item.tile)
+                                  : frame_file_name(item.frame));
+                    glfwPollEvents();
+                },
+                [&] { exporter.finish(); });
+            glfwTerminate();
+            return result;
+        }
+
+        run_export(exporter,
+                   camera,
+                   path,
+                   opts.exportFrames,
+                   [&](const glm::mat4& view)
+                   { draw_scene(view, proj, /*clusteredLights=*/true); });
+        glfwTerminate();
+        return 0;
+    }
+
+    std::string pickInfo = "none";
 
+    // FPS counts scene redraws, so it falls to 0 while the view is idle
+    double fpsStart   = glfwGetTime();
+    auto   frameCount = 0;
+
+    // Damage-driven redraw: the scene is rendered into the frame cache only
+    // when the view state changes, the overlay only when its text changes,
+    // and an expose presents the cache again. Without held keys or texture
+    // streaming the loop sleeps in glfwWaitEventsTimeout.
+    FrameCache frameCache;
+    frameCache.init(overlay_shader);
+    UsageMeter usage;
+    usage.init();
+    ViewState                drawnState;
+    std::vector<OverlayLine> drawnOverlay;
+
+    // With --low-latency the loop waits until fewer than N frames are
+    // queued on the GPU and only then samples input, just before drawing
+    static_assert(LatencyTracker::SLOTS >= MAX_FRAMES_IN_FLIGHT,
+                  "pacing must not wait on untracked frames");
+    LatencyTracker latency;
+    latency.init(glfwGetTime());
+    if (opts.lowLatency) latency.FrameLimit = opts.framesInFlight;
+    const char* modelName = aiScene::GetShortFilename(modelPath.c_str());
+
+    while (!glfwWindowShouldClose(window))
+    {
+        if (latency.FrameLimit > 0)
+        {
+            latency.wait_for_frames(latency.FrameLimit);
+            glfwPollEvents();
+        }
+
+        auto time = glfwGetTime();
+        deltaTime = time - lastFrame;
+        lastFrame = time;
+
+        // Calculate FPS
+        if (time - fpsStart >= 1.0)
+        {
+            currentFPS = frameCount / (time - fpsStart);
+            frameCount = 0;
+            fpsStart   = time;
+        }
+
+        process_input(window);
+
+        if (pickRequested || focusRequested)
+        {
+            RayHit hit;
+            if (bvh.intersect(camera.Position, camera.Front, FLT_MAX, hit))
+            {
+                std::ostringstream info;
+                info << "mesh " << instances[hit.instance].range
+                     << ", instance " << hit.instance << ", triangle "
+                     << hit.triangle;
+                pickInfo = info.str();
+                if (focusRequested)
+                    camera.focus(camera.Position + camera.Front * hit.t);
+            }
+            else
+            {
+                pickInfo = "none";
+            }
+            std::cout << "Pick: " << pickInfo << '\n';
+            pickRequested  = false;
+            focusRequested = false;
+        }
+
+        glm::mat4 model = glm::mat4(1.0);
+        glm::mat4 view  = camera.get_view_matrix();
+        glm::mat4 proj  = glm::perspective(
+            verticalFov, 16.0F / 9.0F, nearPlane, farPlane);
+
+        streamer.update();
+
+        int fbWidth, fbHeight;
+        glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
+        bool      resized = frameCache.resize(fbWidth, fbHeight);
+        ViewState state;
+        state.view           = view;
+        state.mode           = currentMode;
+        state.boundingBox    = showDebugInfo;
+        state.textureChanges = streamer.Changes;
+
+        bool redrawScene = frameCache.valid() &&
+                           (resized || state != drawnState || opts.continuous);
+        if (redrawScene)
+        {
+            usage.begin_gpu();
+            frameCache.begin_scene();
+            draw_scene(view, proj, /*clusteredLights=*/true);
+
+            if (showDebugInfo)
+            {
+                // Set up matrices for bounding box
+                glUseProgram(mesh_shader);
+                glUniformMatrix4fv(glGetUniformLocation(mesh_shader, "model"),
+                                   1,
+                                   GL_FALSE,
+                                   &model[0][0]);
+                glUniformMatrix4fv(glGetUniformLocation(mesh_shader, "view"),
+                                   1,
+                                   GL_FALSE,
+                                   &view[0][0]);
+                glUniformMatrix4fv(
+                    glGetUniformLocation(mesh_shader, "projection"),
+                    1,
+                    GL_FALSE,
+                    &proj[0][0]);
+
+                // Render bounding box
+                glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+                glUniform3f(glGetUniformLocation(mesh_shader, "baseColor"),
+                            1.0,
+                            0.0,
+                            0.0);
+                glUniform1i(glGetUniformLocation(mesh_shader, "useShading"), 0);
+                glUniform1i(
+                    glGetUniformLocation(mesh_shader, "useRandomColor"), 0);
+                glBindVertexArray(bboxVAO);
+                glDrawArrays(GL_LINES, 0, 24);
+                glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+            }
+            frameCache.end();
+            usage.end_gpu();
+
+            drawnState = state;
+            frameCount++;
+            usage.Redraws++;
+        }
+
+        latency.collect();
+        std::vector<OverlayLine> overlay;
         if (showDebugInfo)
+            overlay = debug_overlay(pickInfo,
+                                    totalVertices,
+                                    modelName,
+                                    lighting,
+                                    streamer,
+                                    culler,
+                                    culler.Occluded ? &occlusion : nullptr,
+                                    latency);
+        bool redrawOverlay = frameCache.valid() && showDebugInfo &&
+                             (resized || overlay != drawnOverlay ||
+                              opts.continuous);
+        if (redrawOverlay)
         {
-            // Switch to text shader and set up for 2D rendering
+            usage.begin_gpu();
+            frameCache.begin_overlay();
             glUseProgram(text_shader);
-            glDisable(GL_DEPTH_TEST); // Disable depth testing for UI overlay
-
-            std::ostringstream debugText;
-            debugText << "FPS: " << std::fixed << std::setprecision(1)
-                      << currentFPS;
-            render_text(text_shader,
-                        debugText.str(),
-                        10.0f,
-                        1150.0f,
-                        0.5f,
-                        glm::vec3(1.0f, 1.0f, 1.0f));
-
-            debugText.str("");
-            debugText << "Pos: (" << std::fixed << std::setprecision(1)
-                      << camera.Position.x << ", " << camera.Position.y << ", "
-                      << camera.Position.z << ")";
-            render_text(text_shader,
-                        debugText.str(),
-                        10.0f,
-                        1125.0f,
-                        0.5f,
-                        glm::vec3(1.0f, 1.0f, 1.0f));
-
-            debugText.str("");
-            debugText << "Speed: " << std::fixed << std::setprecision(2)
-                      << camera.get_current_speed();
-            render_text(text_shader,
-                        debugText.str(),
-                        10.0f,
-                        1100.0f,
-                        0.5f,
-                        glm::vec3(1.0f, 1.0f, 1.0f));
+            glDisable(GL_DEPTH_TEST);
+            for (const auto& line : overlay)
+                render_text(text_shader,
+                            line.text,
+                            10.0f,
+                            line.y,
+                            line.scale,
+                            line.color);
+            glEnable(GL_DEPTH_TEST);
+            frameCache.end();
+            usage.end_gpu();
+            usage.OverlayUpdates++;
+        }
+        drawnOverlay = std::move(overlay);
 
-            const char* modeNames[] = { "Shaded", "Wireframe", "Random" };
-            debugText.str("");
-            debugText << "Mode: " << modeNames[currentMode];
-            render_text(text_shader,
-                        debugText.str(),
-                        10.0f,
-                        1075.0f,
-                        0.5f,
-                        glm::vec3(1.0f, 1.0f, 1.0f));
-
-            // Info about model on screen like number of vertices etc. 
-            debugText.str("");
-            debugText << "Vertices: " << totalVertices;
-            render_text(text_shader,
-                        debugText.str(),
-                        10.0f,
-                        1050.0f,
-                        0.5f,
-                        glm::vec3(1.0f, 1.0f, 1.0f));
-            
-            debugText.str("");
-            debugText << "Model Name: " << scene->GetShortFilename(modelPath.c_str());
-            render_text(text_shader,
-                        debugText.str(),
-                        10.0f,
-                        1025.0f,
-                        0.5f,
-                        glm::vec3(1.0f, 1.0f, 1.0f));
-
-            // Controls help
-            render_text(text_shader,
-                        "Controls:",
-                        10.0f,
-                        950.0f,
-                        0.4f,
-                        glm::vec3(0.8f, 0.8f, 0.8f));
-            render_text(text_shader,
-                        "WASD - Move",
-                        10.0f,
-                        920.0f,
-                        0.3f,
-                        glm::vec3(0.7f, 0.7f, 0.7f));
-            render_text(text_shader,
-                        "Space/Shift - Up/Down",
-                        10.0f,
-                        895.0f,
-                        0.3f,
-                        glm::vec3(0.7f, 0.7f, 0.7f));
-            render_text(text_shader,
-                        "Mouse - Look",
-                        10.0f,
-                        870.0f,
-                        0.3f,
-                        glm::vec3(0.7f, 0.7f, 0.7f));
-            render_text(text_shader,
-                        "Tab - Mode",
-                        10.0f,
-                        845.0f,
-                        0.3f,
-                        glm::vec3(0.7f, 0.7f, 0.7f));
-            render_text(text_shader,
-                        "E - Debug",
-                        10.0f,
-                        820.0f,
-                        0.3f,
-                        glm::vec3(0.7f, 0.7f, 0.7f));
-
-            glEnable(GL_DEPTH_TEST); // Re-enable depth testing
-
-            // Switch back to mesh shader for bounding box
-            glUseProgram(mesh_shader);
-
-            // Set up matrices for bounding box
-            glUniformMatrix4fv(glGetUniformLocation(mesh_shader, "model"),
-                               1,
-                               GL_FALSE,
-                               &model[0][0]);
-            glUniformMatrix4fv(glGetUniformLocation(mesh_shader, "view"),
-                               1,
-                               GL_FALSE,
-                               &view[0][0]);
-            glUniformMatrix4fv(glGetUniformLocation(mesh_shader, "projection"),
-                               1,
-                               GL_FALSE,
-                               &proj[0][0]);
-
-            // Render bounding box
-            glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-            glUniform3f(
-                glGetUniformLocation(mesh_shader, "baseColor"), 1.0, 0.0, 0.0);
-            glUniform1i(glGetUniformLocation(mesh_shader, "useShading"), 0);
-            glUniform1i(glGetUniformLocation(mesh_shader, "useRandomColor"), 0);
-            glBindVertexArray(bboxVAO);
-            glDrawArrays(GL_LINES, 0, 24);
-            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        bool present = redrawScene || redrawOverlay || frameExposed;
+        if (frameCache.valid() && present)
+        {
+            usage.begin_gpu();
+            frameCache.present(showDebugInfo);
+            usage.end_gpu();
+            double submit = glfwGetTime();
+            glfwSwapBuffers(window);
+            latency.frame_swapped(pendingInput, submit, glfwGetTime());
+            pendingInput = -1.0;
+            usage.Presents++;
+            timeline.print("Time to first frame");
+            frameExposed = false;
         }
+        // Input that changed nothing on screen has no photon; keeping its
+        // stamp would charge the idle wait to the next frame that does
+        else
+            pendingInput = -1.0;
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        if (opts.reportUsage) usage.report(/*interval=*/5.0);
+
+        if (opts.continuous || movement_keys_held(window))
+        {
+            glfwPollEvents();
+        }
+        else
+        {
+            // Idle: sleep until input, waking for streamed texture levels
+            // and to refresh the FPS and usage figures. Time spent waiting
+            // is not frame time.
+            glfwWaitEventsTimeout(streamer.settled() ? 1.0 : 0.01);
+            lastFrame = glfwGetTime();
+        }
     }
 
+    occlusion.print_summary();
+    latency.release();
+    frameCache.release();
     glfwTerminate();
     return 0;
 }
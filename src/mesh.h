@@ -1,17 +1,182 @@
+#pragma once
 #include "assimp/scene.h"
+#include "vertex_layout.h"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
 #include <iostream>
 #include <ostream>
+#include <vector>
+
+// Passes specialised for one VertexLayout, picked once by analyzeScene
+struct VertexOps
+{
+    int stride; // floats per vertex
+    void (*appendMesh)(const aiMesh* mesh, std::vector<float>& vertices);
+    void (*expandMesh)(const float*        vertices,
+                       size_t              count,
+                       const glm::mat4&    transform,
+                       std::vector<float>& out);
+    PositionStreams (*positions)(const std::vector<float>& vertices,
+                                 ThreadPool&               pool);
+    void (*setupAttributes)();
+};
 
 struct VertexFormat
 {
-    bool hasNormals;
-    bool hasTexCoords;
-    int  stride; // floats per vertex
+    bool             hasNormals;
+    bool             hasTexCoords;
+    int              stride; // floats per vertex
+    const VertexOps* ops;
+};
+
+// One unique aiMesh in the vertex soup, in the mesh's local space
+struct DrawRange
+{
+    size_t       first; // first vertex
+    size_t       count; // vertex count
+    unsigned int material;
+};
+
+// A node's reference to a mesh, placed by the node's world transform
+struct MeshInstance
+{
+    glm::mat4 transform;
+    uint32_t  range; // index of the mesh's DrawRange
 };
 
+glm::mat4 toGlm(const aiMatrix4x4& m)
+{
+    // aiMatrix4x4 is row-major, glm column-major
+    return glm::mat4(glm::vec4(m.a1, m.b1, m.c1, m.d1),
+                     glm::vec4(m.a2, m.b2, m.c2, m.d2),
+                     glm::vec4(m.a3, m.b3, m.c3, m.d3),
+                     glm::vec4(m.a4, m.b4, m.c4, m.d4));
+}
+
+// Bounds of the box lo..hi after transforming it by m (Arvo's method)
+void transformBox(const glm::mat4& m,
+                  const glm::vec3& lo,
+                  const glm::vec3& hi,
+                  glm::vec3&       outLo,
+                  glm::vec3&       outHi)
+{
+    outLo = outHi = glm::vec3(m[3]);
+    for (int c = 0; c < 3; c++)
+        for (int r = 0; r < 3; r++)
+        {
+            float a = m[c][r] * lo[c], b = m[c][r] * hi[c];
+            outLo[r] += std::min(a, b);
+            outHi[r] += std::max(a, b);
+        }
+}
+
+// Appends the triangles of one mesh to the soup as `Layout` vertices
+template <class Layout>
+void appendMesh(const aiMesh* mesh, std::vector<float>& vertices)
+{
+    size_t indices = 0;
+    for (unsigned int j = 0; j < mesh->mNumFaces; j++)
+        indices += mesh->mFaces[j].mNumIndices;
+    size_t first = vertices.size();
+    vertices.resize(first + indices * Layout::stride);
+    float* out = vertices.data() + first;
+
+    // Process each face and extract vertices in order
+    for (unsigned int j = 0; j < mesh->mNumFaces; j++)
+    {
+        aiFace face = mesh->mFaces[j];
+
+        // Each face should be a triangle (due to aiProcess_Triangulate)
+        for (unsigned int k = 0; k < face.mNumIndices; k++)
+        {
+            unsigned int vertexIndex = face.mIndices[k];
+
+            aiVector3D pos = mesh->mVertices[vertexIndex];
+            float*     p   = out + Layout::template offset<Position>();
+            p[0]           = pos.x;
+            p[1]           = pos.y;
+            p[2]           = pos.z;
+
+            // Normal, up for meshes without them
+            aiVector3D normal = mesh->HasNormals()
+                                    ? mesh->mNormals[vertexIndex]
+                                    : aiVector3D(0.0f, 1.0f, 0.0f);
+            float*     n      = out + Layout::template offset<Normal>();
+            n[0]              = normal.x;
+            n[1]              = normal.y;
+            n[2]              = normal.z;
+
+            // Texture coordinates, zero for meshes without them
+            if constexpr (Layout::template has<TexCoord>())
+            {
+                aiVector3D uv = mesh->HasTextureCoords(0)
+                                    ? mesh->mTextureCoords[0][vertexIndex]
+                                    : aiVector3D(0.0f, 0.0f, 0.0f);
+                float*     t  = out + Layout::template offset<TexCoord>();
+                t[0]          = uv.x;
+                t[1]          = uv.y;
+            }
+            out += Layout::stride;
+        }
+    }
+}
+
+// Appends `count` local-space vertices placed by `transform`. Normals are
+// transformed and renormalised, other attributes copied.
+template <class Layout>
+void expandMesh(const float*        vertices,
+                size_t              count,
+                const glm::mat4&    transform,
+                std::vector<float>& out)
+{
+    VertexView<Layout> view(vertices, count);
+    glm::mat3 normal = glm::transpose(glm::inverse(glm::mat3(transform)));
+    size_t    first  = out.size();
+    out.resize(first + count * Layout::stride);
+    for (size_t v = 0; v < count; v++)
+    {
+        float*    dst = &out[first + v * Layout::stride];
+        glm::vec4 pos = transform * glm::vec4(view.position(v), 1.0f);
+        glm::vec3 n   = normal * view.normal(v);
+        float     len = glm::length(n);
+        if (len > 0.0f) n /= len;
+        std::copy(vertices + v * Layout::stride,
+                  vertices + (v + 1) * Layout::stride,
+                  dst);
+        float* p = dst + Layout::template offset<Position>();
+        p[0]     = pos.x;
+        p[1]     = pos.y;
+        p[2]     = pos.z;
+        float* m = dst + Layout::template offset<Normal>();
+        m[0]     = n.x;
+        m[1]     = n.y;
+        m[2]     = n.z;
+    }
+}
+
+template <class Layout>
+const VertexOps* layoutOps()
+{
+    static const VertexOps ops = { Layout::stride,
+                                   &appendMesh<Layout>,
+                                   &expandMesh<Layout>,
+                                   &to_position_streams<Layout>,
+                                   &Layout::setup_attributes };
+    return &ops;
+}
+
+// The specialisation for a scene; texture coordinates are the only
+// optional attribute
+const VertexOps* vertexOps(bool hasTexCoords)
+{
+    return hasTexCoords ? layoutOps<LayoutPNT>() : layoutOps<LayoutPN>();
+}
+
 VertexFormat analyzeScene(const aiScene* scene)
 {
-    VertexFormat fmt = { false, false, 3 }; // minimum: position only
+    VertexFormat fmt = { false, false, 3, nullptr }; // minimum: position only
 
     for (unsigned int i = 0; i < scene->mNumMeshes; i++)
     {
@@ -20,9 +185,10 @@ VertexFormat analyzeScene(const aiScene* scene)
         if (mesh->HasTextureCoords(0)) fmt.hasTexCoords = true;
     }
 
-    fmt.stride = 3; // position
-    if (fmt.hasNormals) fmt.stride += 3;
-    if (fmt.hasTexCoords) fmt.stride += 2;
+    // Normals are always written, appendMesh substitutes a default for
+    // meshes without them
+    fmt.ops    = vertexOps(fmt.hasTexCoords);
+    fmt.stride = fmt.ops->stride;
 
     std::cout << "Scene format: pos=3, normals=" << (fmt.hasNormals ? 3 : 0)
               << ", texcoords=" << (fmt.hasTexCoords ? 2 : 0)
@@ -31,56 +197,129 @@ VertexFormat analyzeScene(const aiScene* scene)
     return fmt;
 }
 
-void extractVertices(aiNode*             node,
-                     const aiScene*      scene,
-                     std::vector<float>& vertices)
+// Walks the node hierarchy accumulating transforms. A mesh is appended to
+// the soup the first time a node references it; every reference becomes an
+// instance. `rangeOf` maps aiMesh index to DrawRange, -1 until appended.
+void extractNode(const aiNode*              node,
+                 const glm::mat4&           parent,
+                 const aiScene*             scene,
+                 const VertexFormat&        fmt,
+                 std::vector<float>&        vertices,
+                 std::vector<DrawRange>&    ranges,
+                 std::vector<MeshInstance>& instances,
+                 std::vector<int>&          rangeOf)
 {
+    glm::mat4 world = parent * toGlm(node->mTransformation);
     for (unsigned int i = 0; i < node->mNumMeshes; i++)
     {
-        aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-
-        std::cout << "Processing mesh " << i << ": " << mesh->mNumFaces
-                  << " faces, " << mesh->mNumVertices << " vertices"
-                  << std::endl;
-
-        // Process each face and extract vertices in order
-        for (unsigned int j = 0; j < mesh->mNumFaces; j++)
+        unsigned int index = node->mMeshes[i];
+        if (rangeOf[index] < 0)
         {
-            aiFace face = mesh->mFaces[j];
+            aiMesh* mesh  = scene->mMeshes[index];
+            size_t  first = vertices.size() / fmt.stride;
 
-            // Each face should be a triangle (due to aiProcess_Triangulate)
-            for (unsigned int k = 0; k < face.mNumIndices; k++)
-            {
-                unsigned int vertexIndex = face.mIndices[k];
-
-                // Position
-                aiVector3D pos = mesh->mVertices[vertexIndex];
-                vertices.push_back(pos.x);
-                vertices.push_back(pos.y);
-                vertices.push_back(pos.z);
-
-                // Normal (with fallback)
-                if (mesh->HasNormals())
-                {
-                    aiVector3D normal = mesh->mNormals[vertexIndex];
-                    vertices.push_back(normal.x);
-                    vertices.push_back(normal.y);
-                    vertices.push_back(normal.z);
-                }
-                else
-                {
-                    // Generate a simple face normal or use default
-                    vertices.push_back(0.0f);
-                    vertices.push_back(1.0f);
-                    vertices.push_back(0.0f);
-                }
-            }
+            std::cout << "Processing mesh " << index << ": " << mesh->mNumFaces
+                      << " faces, " << mesh->mNumVertices << " vertices"
+                      << std::endl;
+            fmt.ops->appendMesh(mesh, vertices);
+
+            size_t count = vertices.size() / fmt.stride - first;
+            if (count == 0) continue; // stays -1, later references skip too
+            rangeOf[index] = int(ranges.size());
+            ranges.push_back({ first, count, mesh->mMaterialIndex });
         }
+        instances.push_back({ world, uint32_t(rangeOf[index]) });
     }
 
     // Process child nodes
     for (unsigned int i = 0; i < node->mNumChildren; i++)
     {
-        extractVertices(node->mChildren[i], scene, vertices);
+        extractNode(node->mChildren[i],
+                    world,
+                    scene,
+                    fmt,
+                    vertices,
+                    ranges,
+                    instances,
+                    rangeOf);
+    }
+}
+
+// Flattens the scene graph: each referenced mesh is stored once in local
+// space, and drawn once per instance
+void extractVertices(const aiScene*             scene,
+                     const VertexFormat&        fmt,
+                     std::vector<float>&        vertices,
+                     std::vector<DrawRange>&    ranges,
+                     std::vector<MeshInstance>& instances)
+{
+    // Reserve the whole soup once, growing a multi-gigabyte vector by
+    // doubling would briefly need several times its size
+    size_t indices = 0;
+    for (unsigned int i = 0; i < scene->mNumMeshes; i++)
+        for (unsigned int j = 0; j < scene->mMeshes[i]->mNumFaces; j++)
+            indices += scene->mMeshes[i]->mFaces[j].mNumIndices;
+    vertices.reserve(vertices.size() + indices * fmt.stride);
+
+    std::vector<int> rangeOf(scene->mNumMeshes, -1);
+    extractNode(scene->mRootNode,
+                glm::mat4(1.0f),
+                scene,
+                fmt,
+                vertices,
+                ranges,
+                instances,
+                rangeOf);
+}
+
+// Vertex count once every instance is expanded into world space
+size_t expandedVertexCount(const std::vector<DrawRange>&    ranges,
+                           const std::vector<MeshInstance>& instances)
+{
+    size_t count = 0;
+    for (const auto& inst : instances)
+        count += ranges[inst.range].count;
+    return count;
+}
+
+// World-space soup with every instance expanded, the layout the renderer
+// used before instancing
+std::vector<float> expandInstances(const std::vector<float>&        vertices,
+                                   const VertexFormat&              fmt,
+                                   const std::vector<DrawRange>&    ranges,
+                                   const std::vector<MeshInstance>& instances)
+{
+    std::vector<float> out;
+    out.reserve(expandedVertexCount(ranges, instances) * fmt.stride);
+    for (const auto& inst : instances)
+    {
+        const DrawRange& r = ranges[inst.range];
+        fmt.ops->expandMesh(
+            &vertices[r.first * fmt.stride], r.count, inst.transform, out);
+    }
+    return out;
+}
+
+// World bounds of all instances
+void sceneBounds(const PositionStreams&           positions,
+                 const std::vector<DrawRange>&    ranges,
+                 const std::vector<MeshInstance>& instances,
+                 glm::vec3&                       boxMin,
+                 glm::vec3&                       boxMax)
+{
+    // Local bounds once per mesh, then one box transform per instance
+    std::vector<glm::vec3> lo(ranges.size()), hi(ranges.size());
+    for (size_t r = 0; r < ranges.size(); r++)
+        stream_bounds(
+            positions, ranges[r].first, ranges[r].count, lo[r], hi[r]);
+
+    boxMin = glm::vec3(FLT_MAX);
+    boxMax = glm::vec3(-FLT_MAX);
+    for (const auto& inst : instances)
+    {
+        glm::vec3 a, b;
+        transformBox(inst.transform, lo[inst.range], hi[inst.range], a, b);
+        boxMin = glm::min(boxMin, a);
+        boxMax = glm::max(boxMax, b);
     }
 }
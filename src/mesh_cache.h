@@ -0,0 +1,258 @@
+#pragma once
+#include "mesh.h"
+#include "options.h"
+#include "textures.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Flattened geometry of a model after import and post-processing, written
+// next to the model as `<model>.meshcache`. Render workers read it instead
+// of importing the model again. Each worker still keeps its own copy of the
+// geometry; only the file reads are shared, through the page cache.
+
+// Identifies the source file and the options that shaped the geometry
+struct MeshCacheKey
+{
+    uint64_t sourceSize  = 0;
+    int64_t  sourceMtime = 0;
+    uint32_t flags       = 0; // assimpPost and normal weighting
+    float    weldEpsilon = 0.0f;
+
+    bool operator==(const MeshCacheKey& o) const
+    {
+        return sourceSize == o.sourceSize && sourceMtime == o.sourceMtime &&
+               flags == o.flags && weldEpsilon == o.weldEpsilon;
+    }
+};
+
+inline MeshCacheKey mesh_cache_key(const std::string& modelPath,
+                                   const Options&     opts)
+{
+    MeshCacheKey key;
+    struct stat  st;
+    if (stat(modelPath.c_str(), &st) == 0)
+    {
+        key.sourceSize  = uint64_t(st.st_size);
+        key.sourceMtime = int64_t(st.st_mtime);
+    }
+    key.flags = (opts.assimpPost ? 1U : 0U) |
+                (opts.normals == NormalWeighting::AREA ? 2U : 0U);
+    key.weldEpsilon = opts.weldEpsilon;
+    return key;
+}
+
+namespace detail
+{
+    const char MESH_CACHE_MAGIC[8] = { 'R', 'M', 'C', 'A', 'C', 'H', 'E', '2' };
+
+    struct MeshCacheHeader
+    {
+        char         magic[8];
+        MeshCacheKey key;
+        uint32_t     stride;
+        uint32_t     hasNormals;
+        uint32_t     hasTexCoords;
+        uint32_t     rangeCount;
+        uint32_t     materialCount;
+        uint32_t     instanceCount;
+        uint64_t     vertexFloats;
+        uint64_t     stringBytes;
+    };
+
+    struct CachedRange
+    {
+        uint64_t first;
+        uint64_t count;
+        uint32_t material;
+        uint32_t reserved;
+    };
+
+    struct CachedInstance
+    {
+        float    transform[16];
+        uint32_t range;
+    };
+} // namespace detail
+
+// Writes to a temporary file first, so a worker never maps a partial cache
+inline bool write_mesh_cache(const std::string&                path,
+                             const MeshCacheKey&               key,
+                             const VertexFormat&               fmt,
+                             const std::vector<float>&         vertices,
+                             const std::vector<DrawRange>&     ranges,
+                             const std::vector<MeshInstance>&  instances,
+                             const std::vector<MaterialPaths>& materials)
+{
+    std::string strings;
+    for (const auto& m : materials)
+    {
+        strings += m.diffuse;
+        strings += '\0';
+        strings += m.normal;
+        strings += '\0';
+    }
+
+    detail::MeshCacheHeader header{};
+    std::memcpy(header.magic, detail::MESH_CACHE_MAGIC, sizeof(header.magic));
+    header.key           = key;
+    header.stride        = uint32_t(fmt.stride);
+    header.hasNormals    = fmt.hasNormals;
+    header.hasTexCoords  = fmt.hasTexCoords;
+    header.rangeCount    = uint32_t(ranges.size());
+    header.materialCount = uint32_t(materials.size());
+    header.instanceCount = uint32_t(instances.size());
+    header.vertexFloats  = vertices.size();
+    header.stringBytes   = strings.size();
+
+    std::vector<detail::CachedRange> cached;
+    for (const auto& r : ranges)
+        cached.push_back({ r.first, r.count, r.material, 0 });
+    std::vector<detail::CachedInstance> cachedInstances(instances.size());
+    for (size_t i = 0; i < instances.size(); i++)
+    {
+        std::memcpy(cachedInstances[i].transform,
+                    &instances[i].transform[0][0],
+                    sizeof(cachedInstances[i].transform));
+        cachedInstances[i].range = instances[i].range;
+    }
+
+    std::string   tmp = path + ".tmp" + std::to_string(getpid());
+    std::ofstream f(tmp, std::ios::binary);
+    f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    f.write(reinterpret_cast<const char*>(cached.data()),
+            std::streamsize(cached.size() * sizeof(detail::CachedRange)));
+    f.write(reinterpret_cast<const char*>(cachedInstances.data()),
+            std::streamsize(cachedInstances.size() *
+                            sizeof(detail::CachedInstance)));
+    f.write(reinterpret_cast<const char*>(vertices.data()),
+            std::streamsize(vertices.size() * sizeof(float)));
+    f.write(strings.data(), std::streamsize(strings.size()));
+    f.close();
+
+    std::error_code ec;
+    if (!f || (std::filesystem::rename(tmp, path, ec), ec))
+    {
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+// Maps the cache and copies it out. Returns false when the file is missing,
+// malformed or was written for a different source or options. Ranges and
+// the stride are checked too, since extraction, culling and upload index
+// the vertices through them unchecked.
+inline bool read_mesh_cache(const std::string&          path,
+                            const MeshCacheKey&         key,
+                            VertexFormat&               fmt,
+                            std::vector<float>&         vertices,
+                            std::vector<DrawRange>&     ranges,
+                            std::vector<MeshInstance>&  instances,
+                            std::vector<MaterialPaths>& materials)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        size_t(st.st_size) < sizeof(detail::MeshCacheHeader))
+    {
+        close(fd);
+        return false;
+    }
+    size_t size = size_t(st.st_size);
+    void*  map  = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    const auto* bytes = static_cast<const uint8_t*>(map);
+    detail::MeshCacheHeader header;
+    std::memcpy(&header, bytes, sizeof(header));
+
+    size_t rangeBytes =
+        size_t(header.rangeCount) * sizeof(detail::CachedRange);
+    size_t instanceBytes =
+        size_t(header.instanceCount) * sizeof(detail::CachedInstance);
+    size_t vertexBytes = size_t(header.vertexFloats) * sizeof(float);
+    size_t total       = sizeof(header) + rangeBytes + instanceBytes +
+                   vertexBytes + size_t(header.stringBytes);
+    bool   valid = std::memcmp(header.magic,
+                               detail::MESH_CACHE_MAGIC,
+                               sizeof(header.magic)) == 0 &&
+                 header.key == key &&
+                 int(header.stride) ==
+                     vertexOps(header.hasTexCoords != 0)->stride &&
+                 header.vertexFloats % header.stride == 0 && total == size &&
+                 (header.stringBytes == 0 || bytes[size - 1] == '\0');
+
+    if (valid)
+    {
+        fmt.stride       = int(header.stride);
+        fmt.hasNormals   = header.hasNormals != 0;
+        fmt.hasTexCoords = header.hasTexCoords != 0;
+        fmt.ops          = vertexOps(fmt.hasTexCoords);
+
+        const uint8_t* p           = bytes + sizeof(header);
+        uint64_t       vertexCount = header.vertexFloats / header.stride;
+        ranges.resize(header.rangeCount);
+        for (auto& r : ranges)
+        {
+            detail::CachedRange c;
+            std::memcpy(&c, p, sizeof(c));
+            p += sizeof(c);
+            r = { size_t(c.first), size_t(c.count), c.material };
+            if (c.first > vertexCount || c.count > vertexCount - c.first)
+                valid = false;
+        }
+
+        instances.resize(header.instanceCount);
+        for (auto& inst : instances)
+        {
+            detail::CachedInstance c;
+            std::memcpy(&c, p, sizeof(c));
+            p += sizeof(c);
+            std::memcpy(
+                &inst.transform[0][0], c.transform, sizeof(c.transform));
+            inst.range = c.range;
+            if (c.range >= header.rangeCount) valid = false;
+        }
+
+        vertices.resize(header.vertexFloats);
+        std::memcpy(vertices.data(), p, vertexBytes);
+        p += vertexBytes;
+
+        // NUL-terminated diffuse/normal pairs
+        const char* s   = reinterpret_cast<const char*>(p);
+        const char* end = s + header.stringBytes;
+        materials.resize(header.materialCount);
+        for (auto& m : materials)
+        {
+            if (s >= end) break;
+            m.diffuse = s;
+            s += m.diffuse.size() + 1;
+            if (s >= end) break;
+            m.normal = s;
+            s += m.normal.size() + 1;
+        }
+    }
+
+    munmap(map, size);
+
+    // The import that replaces a rejected cache appends to these
+    if (!valid)
+    {
+        vertices.clear();
+        ranges.clear();
+        instances.clear();
+        materials.clear();
+    }
+    return valid;
+}
@@ -0,0 +1,419 @@
+#pragma once
+#include "culling.h"
+#include "thread_pool.h"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define OCCLUSION_SSE 1
+#endif
+
+// Software occlusion culling for hosts where GPU queries are not an option.
+// The triangles of a few large occluders are rasterised every frame into a
+// small masked depth buffer on the worker pool, and cluster boxes are
+// tested against it before their draws are issued.
+//
+// The buffer is made of 8x4 pixel tiles, each holding a 32-bit coverage
+// mask and two depth layers (after Hasselgren et al., "Masked Software
+// Occlusion Culling"): `far0` bounds every pixel of the tile, `far1` the
+// pixels in the mask. Once the mask is full, `far1` becomes the new `far0`.
+// Depth is view distance (clip w), so every value is a conservative
+// farthest depth and a box is hidden when it is behind `far0` everywhere.
+class OcclusionBuffer
+{
+public:
+    static constexpr int TILE_W = 8;
+    static constexpr int TILE_H = 4;
+
+    // Last frame
+    double RasterMs          = 0.0;
+    size_t OccluderTriangles = 0;
+
+    // Picks the placed clusters with the most world-space triangle area,
+    // up to `maxTriangles` triangles, and keeps those in world space. The
+    // size is rounded up to whole tiles.
+    void init(int                              width,
+              int                              height,
+              const std::vector<Cluster>&      clusters,
+              const PositionStreams&           positions,
+              const std::vector<PageSpan>&     pages,
+              const std::vector<MeshInstance>& instances,
+              size_t                           maxTriangles = 32768)
+    {
+        tilesX_ = (std::max(width, TILE_W) + TILE_W - 1) / TILE_W;
+        tilesY_ = (std::max(height, TILE_H) + TILE_H - 1) / TILE_H;
+        tiles_.assign(size_t(tilesX_) * tilesY_, Tile{});
+
+        auto vertex_of = [&](const Cluster& c)
+        { return pages[c.page].first + c.first; };
+
+        // Local area once per distinct cluster, instances share geometry
+        std::unordered_map<size_t, float> localArea;
+        std::vector<float>                score(clusters.size());
+        for (size_t i = 0; i < clusters.size(); i++)
+        {
+            const Cluster& c     = clusters[i];
+            size_t         first = vertex_of(c);
+            auto           it    = localArea.find(first);
+            if (it == localArea.end())
+            {
+                float area = 0.0f;
+                for (size_t v = first; v + 2 < first + c.count; v += 3)
+                {
+                    glm::vec3 e1 = positions[v + 1] - positions[v];
+                    glm::vec3 e2 = positions[v + 2] - positions[v];
+                    area += 0.5f * glm::length(glm::cross(e1, e2));
+                }
+                it = localArea.emplace(first, area).first;
+            }
+
+            // Area scale of the instance transform, exact for similarities
+            const glm::mat4& m = instances[c.instance].transform;
+            float sx = glm::length(glm::vec3(m[0])),
+                  sy = glm::length(glm::vec3(m[1])),
+                  sz = glm::length(glm::vec3(m[2]));
+            score[i] = it->second * (sx * sy + sy * sz + sz * sx) / 3.0f;
+        }
+
+        std::vector<size_t> order(clusters.size());
+        std::iota(order.begin(), order.end(), size_t(0));
+        std::sort(order.begin(),
+                  order.end(),
+                  [&](size_t a, size_t b) { return score[a] > score[b]; });
+
+        occluders_.clear();
+        for (size_t i : order)
+        {
+            const Cluster& c = clusters[i];
+            if (occluders_.size() / 3 + c.count / 3 > maxTriangles) break;
+            const glm::mat4& m     = instances[c.instance].transform;
+            size_t           first = vertex_of(c);
+            for (size_t v = first; v < first + c.count / 3 * 3; v++)
+                occluders_.push_back(
+                    glm::vec3(m * glm::vec4(positions[v], 1.0f)));
+        }
+        OccluderTriangles = occluders_.size() / 3;
+        screen_.resize(OccluderTriangles * 2);
+
+        std::cout << "Occlusion buffer " << tilesX_ * TILE_W << "x"
+                  << tilesY_ * TILE_H << ", " << OccluderTriangles
+                  << " occluder triangles\n";
+    }
+
+    // Rasterises the occluders for this frame's view-projection: triangles
+    // are clipped and projected in parallel, then each band of tile rows
+    // is rasterised by one task
+    void render(const glm::mat4& viewProj, ThreadPool& pool)
+    {
+        auto start = std::chrono::steady_clock::now();
+        viewProj_  = viewProj;
+
+        pool.parallel_for(OccluderTriangles,
+                          1024,
+                          [&](size_t begin, size_t end)
+                          {
+                              for (size_t t = begin; t < end; t++)
+                                  setup_triangle(t);
+                          });
+
+        size_t rowsPerTask = std::max<size_t>(
+            1, size_t(tilesY_) / (2 * (pool.size() + 1)));
+        pool.parallel_for(size_t(tilesY_),
+                          rowsPerTask,
+                          [&](size_t begin, size_t end)
+                          { raster_rows(int(begin), int(end)); });
+
+        RasterMs = std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+        frames_++;
+        totalRasterMs_ += RasterMs;
+    }
+
+    // True when the box is certainly hidden behind the occluders
+    bool occluded(const glm::vec3& boxMin, const glm::vec3& boxMax) const
+    {
+        float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+        float nearest = FLT_MAX;
+        for (int i = 0; i < 8; i++)
+        {
+            glm::vec3 p(i & 1 ? boxMax.x : boxMin.x,
+                        i & 2 ? boxMax.y : boxMin.y,
+                        i & 4 ? boxMax.z : boxMin.z);
+            glm::vec4 clip = viewProj_ * glm::vec4(p, 1.0f);
+            if (clip.z < -clip.w) return false; // crosses the near plane
+            float x = (clip.x / clip.w * 0.5f + 0.5f) * tilesX_ * TILE_W;
+            float y = (clip.y / clip.w * 0.5f + 0.5f) * tilesY_ * TILE_H;
+            minX    = std::min(minX, x);
+            maxX    = std::max(maxX, x);
+            minY    = std::min(minY, y);
+            maxY    = std::max(maxY, y);
+            nearest = std::min(nearest, clip.w);
+        }
+
+        int tx0 = std::max(0, int(std::floor(minX)) / TILE_W);
+        int ty0 = std::max(0, int(std::floor(minY)) / TILE_H);
+        int tx1 = std::min(tilesX_ - 1, int(std::floor(maxX)) / TILE_W);
+        int ty1 = std::min(tilesY_ - 1, int(std::floor(maxY)) / TILE_H);
+        if (maxX < 0.0f || maxY < 0.0f || tx0 > tx1 || ty0 > ty1)
+            return false; // off screen, left to the frustum test
+
+        for (int ty = ty0; ty <= ty1; ty++)
+            for (int tx = tx0; tx <= tx1; tx++)
+                if (nearest <= tiles_[size_t(ty) * tilesX_ + tx].far0 *
+                                   (1.0f + DEPTH_BIAS))
+                    return false;
+        return true;
+    }
+
+    // Accumulates one frame of test results for the summary
+    void record(double testMs, size_t testedTriangles, size_t culledTriangles)
+    {
+        totalTestMs_ += testMs;
+        testedTriangles_ += testedTriangles;
+        culledTriangles_ += culledTriangles;
+    }
+
+    void print_summary() const
+    {
+        if (frames_ == 0) return;
+        std::cout << "Occlusion culling over " << frames_
+                  << " frames: raster " << totalRasterMs_ / frames_
+                  << " ms, test " << totalTestMs_ / frames_ << " ms, "
+                  << (testedTriangles_
+                          ? 100.0 * culledTriangles_ / testedTriangles_
+                          : 0.0)
+                  << "% of triangles in the frustum culled\n";
+    }
+
+private:
+    // Relative margin a box must lie behind `far0` by to be hidden. A flat
+    // cluster facing the camera has the same depth as its own occluder
+    // triangles and the coplanar ones next to it, and must stay visible.
+    static constexpr float DEPTH_BIAS = 1e-3f;
+
+    struct Tile
+    {
+        float    far0 = std::numeric_limits<float>::infinity();
+        float    far1 = 0.0f;
+        uint32_t mask = 0;
+    };
+
+    // A clipped occluder triangle in pixels, counter-clockwise, with edge
+    // functions A x + B y + C >= 0 inside. Doubles keep the edge setup
+    // exact for vertices far outside the screen. 1/w is affine in screen
+    // space, so its plane bounds the depth over any tile.
+    struct ScreenTri
+    {
+        double a[3], b[3], c[3];
+        double za, zb, zc; // 1/w = za x + zb y + zc
+        float  far;        // farthest vertex depth
+        int    tx0, ty0, tx1, ty1;
+        bool   valid;
+    };
+
+    // Clips occluder `t` against the near plane and projects the result,
+    // at most two triangles, into screen_[2t] and screen_[2t + 1]
+    void setup_triangle(size_t t)
+    {
+        screen_[2 * t].valid = screen_[2 * t + 1].valid = false;
+
+        glm::vec4 in[3], out[4];
+        for (int i = 0; i < 3; i++)
+            in[i] = viewProj_ * glm::vec4(occluders_[3 * t + i], 1.0f);
+
+        // Sutherland-Hodgman against z >= -w
+        int n = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            const glm::vec4& p  = in[i];
+            const glm::vec4& q  = in[(i + 1) % 3];
+            float            dp = p.z + p.w, dq = q.z + q.w;
+            if (dp >= 0.0f) out[n++] = p;
+            if ((dp >= 0.0f) != (dq >= 0.0f))
+                out[n++] = p + (q - p) * (dp / (dp - dq));
+        }
+        if (n < 3) return;
+
+        for (int k = 0; k + 2 < n; k++)
+            project(out[0], out[k + 1], out[k + 2], screen_[2 * t + k]);
+    }
+
+    void project(const glm::vec4& p0,
+                 const glm::vec4& p1,
+                 const glm::vec4& p2,
+                 ScreenTri&       tri) const
+    {
+        const glm::vec4* p[3] = { &p0, &p1, &p2 };
+        double           x[3], y[3], z[3];
+        float            far = 0.0f;
+        for (int i = 0; i < 3; i++)
+        {
+            if (p[i]->w <= 0.0f) return;
+            x[i] = (double(p[i]->x) / p[i]->w * 0.5 + 0.5) * tilesX_ * TILE_W;
+            y[i] = (double(p[i]->y) / p[i]->w * 0.5 + 0.5) * tilesY_ * TILE_H;
+            z[i] = 1.0 / p[i]->w;
+            far  = std::max(far, p[i]->w);
+        }
+
+        double area = (x[1] - x[0]) * (y[2] - y[0]) -
+                      (x[2] - x[0]) * (y[1] - y[0]);
+        if (std::fabs(area) < 1e-6) return;
+        double dx1 = x[1] - x[0], dy1 = y[1] - y[0], dz1 = z[1] - z[0];
+        double dx2 = x[2] - x[0], dy2 = y[2] - y[0], dz2 = z[2] - z[0];
+        tri.za     = (dz1 * dy2 - dz2 * dy1) / area;
+        tri.zb     = (dx1 * dz2 - dx2 * dz1) / area;
+        tri.zc     = z[0] - tri.za * x[0] - tri.zb * y[0];
+        if (area < 0.0)
+        {
+            std::swap(x[1], x[2]);
+            std::swap(y[1], y[2]);
+        }
+
+        double minX = std::min({ x[0], x[1], x[2] });
+        double maxX = std::max({ x[0], x[1], x[2] });
+        double minY = std::min({ y[0], y[1], y[2] });
+        double maxY = std::max({ y[0], y[1], y[2] });
+        double w = tilesX_ * TILE_W, h = tilesY_ * TILE_H;
+        if (maxX < 0.0 || maxY < 0.0 || minX >= w || minY >= h) return;
+
+        for (int i = 0; i < 3; i++)
+        {
+            int j    = (i + 1) % 3;
+            tri.a[i] = -(y[j] - y[i]);
+            tri.b[i] = x[j] - x[i];
+            tri.c[i] = -(tri.a[i] * x[i] + tri.b[i] * y[i]);
+        }
+        tri.far   = far;
+        tri.tx0   = int(std::max(0.0, minX)) / TILE_W;
+        tri.ty0   = int(std::max(0.0, minY)) / TILE_H;
+        tri.tx1   = int(std::min(w - 1.0, maxX)) / TILE_W;
+        tri.ty1   = int(std::min(h - 1.0, maxY)) / TILE_H;
+        tri.valid = true;
+    }
+
+    // Pixel-centre coverage of one tile, bit y * TILE_W + x, four pixels
+    // per SSE compare
+    static uint32_t coverage(const ScreenTri& tri, int tx, int ty)
+    {
+        double ox = tx * TILE_W, oy = ty * TILE_H;
+#ifdef OCCLUSION_SSE
+        const __m128 zero = _mm_setzero_ps();
+        __m128       inside[TILE_H * 2];
+        for (int k = 0; k < TILE_H * 2; k++)
+            inside[k] = _mm_cmpeq_ps(zero, zero); // all bits set
+
+        const __m128 dx0 = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        const __m128 dx1 = _mm_setr_ps(4.5f, 5.5f, 6.5f, 7.5f);
+        for (int e = 0; e < 3; e++)
+        {
+            // Edge value at the tile origin, then small float offsets
+            float  origin = float(tri.a[e] * ox + tri.b[e] * oy + tri.c[e]);
+            __m128 a      = _mm_set1_ps(float(tri.a[e]));
+            __m128 row0   = _mm_add_ps(_mm_set1_ps(origin), _mm_mul_ps(a, dx0));
+            __m128 row1   = _mm_add_ps(_mm_set1_ps(origin), _mm_mul_ps(a, dx1));
+            for (int r = 0; r < TILE_H; r++)
+            {
+                __m128 dy = _mm_set1_ps(float(tri.b[e]) * (r + 0.5f));
+                inside[2 * r] = _mm_and_ps(
+                    inside[2 * r], _mm_cmpge_ps(_mm_add_ps(row0, dy), zero));
+                inside[2 * r + 1] =
+                    _mm_and_ps(inside[2 * r + 1],
+                               _mm_cmpge_ps(_mm_add_ps(row1, dy), zero));
+            }
+        }
+
+        uint32_t mask = 0;
+        for (int k = 0; k < TILE_H * 2; k++)
+            mask |= uint32_t(_mm_movemask_ps(inside[k])) << (4 * k);
+        return mask;
+#else
+        uint32_t mask = ~0U;
+        for (int e = 0; e < 3; e++)
+        {
+            float origin = float(tri.a[e] * ox + tri.b[e] * oy + tri.c[e]);
+            float a = float(tri.a[e]), b = float(tri.b[e]);
+            for (int r = 0; r < TILE_H; r++)
+                for (int x = 0; x < TILE_W; x++)
+                    if (origin + a * (x + 0.5f) + b * (r + 0.5f) < 0.0f)
+                        mask &= ~(1U << (r * TILE_W + x));
+        }
+        return mask;
+#endif
+    }
+
+    // Farthest depth of the triangle within a tile: the smallest 1/w at a
+    // tile corner, never beyond the farthest vertex
+    static float tile_far(const ScreenTri& tri, int tx, int ty)
+    {
+        double x = tri.za < 0.0 ? (tx + 1) * TILE_W : tx * TILE_W;
+        double y = tri.zb < 0.0 ? (ty + 1) * TILE_H : ty * TILE_H;
+        double invW = tri.za * x + tri.zb * y + tri.zc;
+        return invW > 1.0 / tri.far ? float(1.0 / invW) : tri.far;
+    }
+
+    // Merges a triangle covering `mask` no farther than `far` into a tile
+    static void merge(Tile& tile, uint32_t mask, float far)
+    {
+        if (far >= tile.far0) return; // adds nothing to the bound
+
+        // A much nearer triangle starts a new layer, dropping the old
+        // partial coverage, which only loses culling, never correctness
+        if (tile.mask == 0 || tile.far1 - far > tile.far0 - tile.far1)
+        {
+            tile.far1 = far;
+            tile.mask = 0;
+        }
+        tile.far1 = std::max(tile.far1, far);
+        tile.mask |= mask;
+        if (tile.mask == ~0U)
+        {
+            tile.far0 = tile.far1;
+            tile.far1 = 0.0f;
+            tile.mask = 0;
+        }
+    }
+
+    void raster_rows(int rowBegin, int rowEnd)
+    {
+        std::fill(tiles_.begin() + size_t(rowBegin) * tilesX_,
+                  tiles_.begin() + size_t(rowEnd) * tilesX_,
+                  Tile{});
+        for (const ScreenTri& tri : screen_)
+        {
+            if (!tri.valid || tri.ty1 < rowBegin || tri.ty0 >= rowEnd) continue;
+            int ty1 = std::min(tri.ty1, rowEnd - 1);
+            for (int ty = std::max(tri.ty0, rowBegin); ty <= ty1; ty++)
+                for (int tx = tri.tx0; tx <= tri.tx1; tx++)
+                {
+                    uint32_t mask = coverage(tri, tx, ty);
+                    if (mask)
+                        merge(tiles_[size_t(ty) * tilesX_ + tx],
+                              mask,
+                              tile_far(tri, tx, ty));
+                }
+        }
+    }
+
+    int                    tilesX_ = 0, tilesY_ = 0;
+    std::vector<Tile>      tiles_;
+    std::vector<glm::vec3> occluders_; // world space, 3 per triangle
+    std::vector<ScreenTri> screen_;    // 2 per occluder after clipping
+    glm::mat4              viewProj_{ 1.0f };
+
+    size_t frames_          = 0;
+    double totalRasterMs_   = 0.0;
+    double totalTestMs_     = 0.0;
+    size_t testedTriangles_ = 0;
+    size_t culledTriangles_ = 0;
+};
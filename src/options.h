@@ -0,0 +1,316 @@
+#pragma once
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// Most frames --low-latency may queue; LatencyTracker tracks this many
+constexpr int MAX_FRAMES_IN_FLIGHT = 8;
+
+// Which path is used to cull clusters before drawing
+enum class CullMode
+{
+    AUTO, // GPU compute when available, otherwise CPU
+    GPU,
+    CPU,
+    OFF,
+};
+
+// How generated vertex normals weight the faces around a vertex
+enum class NormalWeighting
+{
+    AREA,  // by triangle area
+    ANGLE, // by the corner angle at the vertex
+};
+
+struct Options
+{
+    std::string     modelPath;
+    CullMode        cullMode        = CullMode::AUTO;
+    bool            coneCull        = false; // backface-cone rejection
+    bool            occlusion       = false; // software occlusion culling
+    unsigned int    occlusionWidth  = 256;
+    unsigned int    occlusionHeight = 144;
+    size_t          lightCount      = 0;     // random point lights in the bbox
+    bool            benchLights     = false;
+    size_t          textureBudgetMB = 256;   // GPU memory for streamed mips
+    size_t          pageMB          = 256;   // vertex buffer page size
+    bool            assimpPost      = false; // Assimp weld/normals instead
+    float           weldEpsilon     = 0.0f;  // <= 0 derives it from the bbox
+    NormalWeighting normals         = NormalWeighting::ANGLE;
+    bool            comparePost     = false; // time against Assimp's steps
+    bool            compareExpanded = false; // time the non-instanced soup
+    bool            collide         = false; // stop the camera at geometry
+    bool            benchBvh        = false;
+    bool            continuous      = false; // redraw every frame
+    bool            reportUsage     = false; // print CPU/GPU usage
+    int             swapInterval    = 1;     // 0 presents without vsync
+    bool            lowLatency      = false; // late input, few frames queued
+    int             framesInFlight  = 1;     // with lowLatency
+    bool            benchLatency    = false;
+    std::string     exportDir;                // image sequence output
+    std::string     exportPath;               // keyframes, orbit if empty
+    size_t          exportFrames    = 360;
+    unsigned int    exportWidth     = 1920;
+    unsigned int    exportHeight    = 1080;
+    bool            exportQoi       = false; // PNG otherwise
+    size_t          workers         = 0;     // export in worker processes
+    unsigned int    exportTiles     = 1;     // strips per frame with workers
+    std::string     workerSocket;             // set on spawned workers
+    std::string     thumbnailInput;           // model directory or list file
+    std::string     thumbnailDir    = "thumbnails";
+    unsigned int    thumbnailSize   = 256;
+};
+
+inline void print_usage(const char* exe)
+{
+    std::cerr << "Usage: " << exe << " <path_to_model.obj> [options]\n"
+              << "       " << exe << " --thumbnails=DIR|LIST [options]\n"
+              << "  --cull=auto|gpu|cpu|off  Cluster culling path\n"
+              << "  --cone-cull              Reject back-facing clusters\n"
+              << "  --occlusion[=WxH]        CPU occlusion culling buffer\n"
+              << "  --lights=N               Add N random point lights\n"
+              << "  --bench-lights           Time shading against light count\n"
+              << "  --texture-budget=MB      GPU memory for texture mips\n"
+              << "  --page-size=MB           Vertex buffer page size\n"
+              << "  --assimp-post            Weld and generate normals in Assimp\n"
+              << "  --weld-epsilon=E         Vertex weld distance\n"
+              << "  --normals=area|angle     Generated normal weighting\n"
+              << "  --compare-post           Time post-processing against Assimp\n"
+              << "  --compare-expanded       Time the non-instanced soup\n"
+              << "  --collide                Keep the camera out of geometry\n"
+              << "  --bench-bvh              Time BVH ray queries and exit\n"
+              << "  --continuous             Redraw every frame, even idle\n"
+              << "  --report-usage           Print CPU/GPU usage every 5 s\n"
+              << "  --swap-interval=N        Vsync interval (default 1)\n"
+              << "  --low-latency[=N]        Late input, N (1-8) frames queued\n"
+              << "  --bench-latency          Time input latency and exit\n"
+              << "  --export=DIR             Render an image sequence, exit\n"
+              << "  --export-path=FILE       Keyframed camera path to export\n"
+              << "  --export-frames=N        Frames to export (default 360)\n"
+              << "  --export-size=WxH        Export resolution\n"
+              << "  --export-format=png|qoi  Export image format\n"
+              << "  --workers=N              Export in N worker processes\n"
+              << "  --export-tiles=N         Split frames into N strips\n"
+              << "  --thumbnails=DIR|LIST    Thumbnail every model, then exit\n"
+              << "  --thumb-out=DIR          Thumbnail directory\n"
+              << "  --thumb-size=N           Thumbnail size in pixels\n";
+}
+
+// Returns false if the arguments are invalid
+inline bool parse_options(int argc, char** argv, Options& opts)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg   = argv[i];
+        auto        value = [&](const char* prefix) -> const char*
+        {
+            size_t n = std::strlen(prefix);
+            return arg.compare(0, n, prefix) == 0 ? argv[i] + n : nullptr;
+        };
+
+        if (const char* v = value("--cull="))
+        {
+            std::string mode = v;
+            if (mode == "auto") opts.cullMode = CullMode::AUTO;
+            else if (mode == "gpu") opts.cullMode = CullMode::GPU;
+            else if (mode == "cpu") opts.cullMode = CullMode::CPU;
+            else if (mode == "off") opts.cullMode = CullMode::OFF;
+            else
+            {
+                std::cerr << "Unknown cull mode: " << mode << '\n';
+                return false;
+            }
+        }
+        else if (arg == "--cone-cull")
+        {
+            opts.coneCull = true;
+        }
+        else if (arg == "--occlusion")
+        {
+            opts.occlusion = true;
+        }
+        else if (const char* v = value("--occlusion="))
+        {
+            char* end            = nullptr;
+            opts.occlusion       = true;
+            opts.occlusionWidth  = unsigned(std::strtoul(v, &end, 10));
+            opts.occlusionHeight = 0;
+            if (*end == 'x')
+                opts.occlusionHeight =
+                    unsigned(std::strtoul(end + 1, nullptr, 10));
+            if (opts.occlusionWidth == 0 || opts.occlusionHeight == 0)
+            {
+                std::cerr << "Invalid occlusion buffer size: " << v << '\n';
+                return false;
+            }
+        }
+        else if (const char* v = value("--lights="))
+        {
+            opts.lightCount = std::strtoul(v, nullptr, 10);
+        }
+        else if (arg == "--bench-lights")
+        {
+            opts.benchLights = true;
+        }
+        else if (const char* v = value("--texture-budget="))
+        {
+            opts.textureBudgetMB = std::strtoul(v, nullptr, 10);
+        }
+        else if (const char* v = value("--page-size="))
+        {
+            opts.pageMB = std::strtoul(v, nullptr, 10);
+            if (opts.pageMB == 0)
+            {
+                std::cerr << "Invalid page size: " << v << '\n';
+                return false;
+            }
+        }
+        else if (arg == "--assimp-post")
+        {
+            opts.assimpPost = true;
+        }
+        else if (const char* v = value("--weld-epsilon="))
+        {
+            opts.weldEpsilon = std::strtof(v, nullptr);
+        }
+        else if (const char* v = value("--normals="))
+        {
+            std::string mode = v;
+            if (mode == "area") opts.normals = NormalWeighting::AREA;
+            else if (mode == "angle") opts.normals = NormalWeighting::ANGLE;
+            else
+            {
+                std::cerr << "Unknown normal weighting: " << mode << '\n';
+                return false;
+            }
+        }
+        else if (arg == "--compare-post")
+        {
+            opts.comparePost = true;
+        }
+        else if (arg == "--compare-expanded")
+        {
+            opts.compareExpanded = true;
+        }
+        else if (arg == "--collide")
+        {
+            opts.collide = true;
+        }
+        else if (arg == "--bench-bvh")
+        {
+            opts.benchBvh = true;
+        }
+        else if (arg == "--continuous")
+        {
+            opts.continuous = true;
+        }
+        else if (arg == "--report-usage")
+        {
+            opts.reportUsage = true;
+        }
+        else if (const char* v = value("--swap-interval="))
+        {
+            opts.swapInterval = std::atoi(v);
+        }
+        else if (arg == "--low-latency")
+        {
+            opts.lowLatency = true;
+        }
+        else if (const char* v = value("--low-latency="))
+        {
+            opts.lowLatency     = true;
+            opts.framesInFlight = std::atoi(v);
+            if (opts.framesInFlight < 1 ||
+                opts.framesInFlight > MAX_FRAMES_IN_FLIGHT)
+            {
+                std::cerr << "Invalid frames in flight: " << v << '\n';
+                return false;
+            }
+        }
+        else if (arg == "--bench-latency")
+        {
+            opts.benchLatency = true;
+        }
+        else if (const char* v = value("--export="))
+        {
+            opts.exportDir = v;
+        }
+        else if (const char* v = value("--export-path="))
+        {
+            opts.exportPath = v;
+        }
+        else if (const char* v = value("--export-frames="))
+        {
+            opts.exportFrames = std::strtoul(v, nullptr, 10);
+        }
+        else if (const char* v = value("--export-size="))
+        {
+            char* end         = nullptr;
+            opts.exportWidth  = unsigned(std::strtoul(v, &end, 10));
+            opts.exportHeight = 0;
+            if (*end == 'x')
+                opts.exportHeight = unsigned(std::strtoul(end + 1, nullptr, 10));
+            if (opts.exportWidth == 0 || opts.exportHeight == 0)
+            {
+                std::cerr << "Invalid export size: " << v << '\n';
+                return false;
+            }
+        }
+        else if (const char* v = value("--export-format="))
+        {
+            std::string format = v;
+            if (format == "png") opts.exportQoi = false;
+            else if (format == "qoi") opts.exportQoi = true;
+            else
+            {
+                std::cerr << "Unknown export format: " << format << '\n';
+                return false;
+            }
+        }
+        else if (const char* v = value("--workers="))
+        {
+            opts.workers = std::strtoul(v, nullptr, 10);
+        }
+        else if (const char* v = value("--export-tiles="))
+        {
+            opts.exportTiles = unsigned(std::strtoul(v, nullptr, 10));
+            if (opts.exportTiles == 0)
+            {
+                std::cerr << "Invalid tile count: " << v << '\n';
+                return false;
+            }
+        }
+        else if (const char* v = value("--worker="))
+        {
+            opts.workerSocket = v;
+        }
+        else if (const char* v = value("--thumbnails="))
+        {
+            opts.thumbnailInput = v;
+        }
+        else if (const char* v = value("--thumb-out="))
+        {
+            opts.thumbnailDir = v;
+        }
+        else if (const char* v = value("--thumb-size="))
+        {
+            opts.thumbnailSize = unsigned(std::strtoul(v, nullptr, 10));
+            if (opts.thumbnailSize == 0)
+            {
+                std::cerr << "Invalid thumbnail size: " << v << '\n';
+                return false;
+            }
+        }
+        else if (arg.compare(0, 2, "--") == 0)
+        {
+            std::cerr << "Unknown option: " << arg << '\n';
+            return false;
+        }
+        else if (opts.modelPath.empty())
+        {
+            opts.modelPath = arg;
+        }
+    }
+    return !opts.modelPath.empty() || !opts.thumbnailInput.empty();
+}
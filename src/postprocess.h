@@ -0,0 +1,491 @@
+#pragma once
+#include "options.h"
+#include "thread_pool.h"
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <vector>
+
+// Replacement for aiProcess_JoinIdenticalVertices and aiProcess_GenNormals.
+// Both run inside Assimp on one thread; these split the work over the pool.
+
+struct PostProcessStats
+{
+    double weldMs         = 0.0;
+    double normalsMs      = 0.0;
+    size_t verticesBefore = 0;
+    size_t verticesAfter  = 0;
+    size_t meshesNormals  = 0; // meshes that got generated normals
+};
+
+// Sorts chunks in parallel, then merges neighbouring chunks pairwise
+template <class T, class Less>
+void parallel_sort(std::vector<T>& v, Less less, ThreadPool& pool)
+{
+    size_t parts = std::min(pool.size() + 1, std::max<size_t>(1, v.size() / 4096));
+    auto   bound = [&](size_t p) { return v.begin() + v.size() * p / parts; };
+
+    pool.parallel_for(parts,
+                      1,
+                      [&](size_t begin, size_t end)
+                      {
+                          for (size_t p = begin; p < end; p++)
+                              std::sort(bound(p), bound(p + 1), less);
+                      });
+
+    for (size_t width = 1; width < parts; width *= 2)
+    {
+        size_t pairs = (parts + 2 * width - 1) / (2 * width);
+        pool.parallel_for(
+            pairs,
+            1,
+            [&](size_t begin, size_t end)
+            {
+                for (size_t i = begin; i < end; i++)
+                {
+                    size_t lo  = i * 2 * width;
+                    size_t mid = std::min(lo + width, parts);
+                    size_t hi  = std::min(lo + 2 * width, parts);
+                    std::inplace_merge(bound(lo), bound(mid), bound(hi), less);
+                }
+            });
+    }
+}
+
+// Exclusive prefix sum of `flags`, computed in chunks. Returns the total.
+inline uint32_t parallel_prefix_sum(const std::vector<uint8_t>& flags,
+                                    std::vector<uint32_t>&      offsets,
+                                    ThreadPool&                 pool)
+{
+    const size_t grain  = 1 << 16;
+    size_t       chunks = (flags.size() + grain - 1) / grain;
+    std::vector<uint32_t> chunkSums(chunks + 1, 0);
+    offsets.resize(flags.size());
+
+    pool.parallel_for(chunks,
+                      1,
+                      [&](size_t begin, size_t end)
+                      {
+                          for (size_t c = begin; c < end; c++)
+                          {
+                              size_t last = std::min(flags.size(), (c + 1) * grain);
+                              uint32_t sum = 0;
+                              for (size_t i = c * grain; i < last; i++)
+                                  sum += flags[i];
+                              chunkSums[c + 1] = sum;
+                          }
+                      });
+    for (size_t c = 0; c < chunks; c++)
+        chunkSums[c + 1] += chunkSums[c];
+
+    pool.parallel_for(chunks,
+                      1,
+                      [&](size_t begin, size_t end)
+                      {
+                          for (size_t c = begin; c < end; c++)
+                          {
+                              size_t last = std::min(flags.size(), (c + 1) * grain);
+                              uint32_t sum = chunkSums[c];
+                              for (size_t i = c * grain; i < last; i++)
+                              {
+                                  offsets[i] = sum;
+                                  sum += flags[i];
+                              }
+                          }
+                      });
+    return chunkSums[chunks];
+}
+
+namespace detail
+{
+    inline bool near_equal(const aiVector3D& a, const aiVector3D& b, float eps)
+    {
+        return std::fabs(a.x - b.x) <= eps && std::fabs(a.y - b.y) <= eps &&
+               std::fabs(a.z - b.z) <= eps;
+    }
+
+    // Attributes other than position must match for two vertices to merge,
+    // otherwise UV seams and hard edges would be lost
+    inline bool same_attributes(const aiMesh* mesh, uint32_t a, uint32_t b)
+    {
+        const float attributeEps = 1e-5f;
+        if (mesh->HasNormals() &&
+            !near_equal(mesh->mNormals[a], mesh->mNormals[b], attributeEps))
+            return false;
+        for (unsigned int c = 0; c < AI_MAX_NUMBER_OF_TEXTURECOORDS; c++)
+            if (mesh->HasTextureCoords(c) &&
+                !near_equal(mesh->mTextureCoords[c][a],
+                            mesh->mTextureCoords[c][b],
+                            attributeEps))
+                return false;
+        for (unsigned int c = 0; c < AI_MAX_NUMBER_OF_COLOR_SETS; c++)
+            if (mesh->HasVertexColors(c) &&
+                std::memcmp(&mesh->mColors[c][a],
+                            &mesh->mColors[c][b],
+                            sizeof(aiColor4D)) != 0)
+                return false;
+        return true;
+    }
+
+    // Replaces `array` with the representatives' values in their new order
+    template <class T>
+    void compact_stream(T*&                          array,
+                        const std::vector<uint8_t>&  isRep,
+                        const std::vector<uint32_t>& newIndex,
+                        uint32_t                     newCount,
+                        ThreadPool&                  pool)
+    {
+        if (!array) return;
+        T* out = new T[newCount];
+        pool.parallel_for(isRep.size(),
+                          1 << 14,
+                          [&](size_t begin, size_t end)
+                          {
+                              for (size_t i = begin; i < end; i++)
+                                  if (isRep[i]) out[newIndex[i]] = array[i];
+                          });
+        delete[] array;
+        array = out;
+    }
+} // namespace detail
+
+// Merges vertices that snap to the same `epsilon` grid cell and carry the
+// same attributes, then reindexes the faces. Cell keys are computed in
+// parallel, sorted with parallel_sort, and runs of equal keys resolved per
+// chunk. Returns the new vertex count.
+inline uint32_t weld_vertices(aiMesh* mesh, float epsilon, ThreadPool& pool)
+{
+    uint32_t n = mesh->mNumVertices;
+    // Bone weights reference vertex ids; the viewer ignores them, but
+    // leaving them dangling would corrupt the scene for anyone else
+    if (n == 0 || mesh->HasBones() || epsilon <= 0.0f) return n;
+
+    struct Cell
+    {
+        int64_t x, y, z;
+    };
+    std::vector<Cell>     cells(n);
+    std::vector<uint64_t> keys(n);
+    float                 inv   = 1.0f / epsilon;
+    const size_t          grain = 1 << 14;
+
+    pool.parallel_for(n,
+                      grain,
+                      [&](size_t begin, size_t end)
+                      {
+                          for (size_t i = begin; i < end; i++)
+                          {
+                              const aiVector3D& p = mesh->mVertices[i];
+                              Cell c{ int64_t(std::floor(p.x * inv)),
+                                      int64_t(std::floor(p.y * inv)),
+                                      int64_t(std::floor(p.z * inv)) };
+                              cells[i] = c;
+                              keys[i]  = uint64_t(c.x) * 73856093ULL ^
+                                        uint64_t(c.y) * 19349663ULL ^
+                                        uint64_t(c.z) * 83492791ULL;
+                          }
+                      });
+
+    std::vector<uint32_t> order(n);
+    std::iota(order.begin(), order.end(), 0U);
+    parallel_sort(
+        order,
+        [&](uint32_t a, uint32_t b)
+        { return keys[a] != keys[b] ? keys[a] < keys[b] : a < b; },
+        pool);
+
+    // remap[i] is the lowest-index vertex i merges with. Chunks are moved to
+    // the next run boundary so no run is split between workers.
+    std::vector<uint32_t> remap(n);
+    size_t                chunks = (n + grain - 1) / grain;
+    auto                  chunk_start = [&](size_t c)
+    {
+        size_t s = std::min<size_t>(n, c * grain);
+        while (s > 0 && s < n && keys[order[s]] == keys[order[s - 1]])
+            s++;
+        return s;
+    };
+    pool.parallel_for(
+        chunks,
+        1,
+        [&](size_t begin, size_t end)
+        {
+            for (size_t c = begin; c < end; c++)
+            {
+                size_t last = chunk_start(c + 1);
+                for (size_t s = chunk_start(c); s < last;)
+                {
+                    size_t e = s + 1;
+                    while (e < n && keys[order[e]] == keys[order[s]])
+                        e++;
+                    for (size_t i = s; i < e; i++)
+                    {
+                        uint32_t v = order[i];
+                        remap[v]   = v;
+                        for (size_t j = s; j < i; j++)
+                        {
+                            uint32_t r = order[j];
+                            if (remap[r] != r) continue;
+                            const Cell& a = cells[v];
+                            const Cell& b = cells[r];
+                            if (a.x == b.x && a.y == b.y && a.z == b.z &&
+                                detail::same_attributes(mesh, v, r))
+                            {
+                                remap[v] = r;
+                                break;
+                            }
+                        }
+                    }
+                    s = e;
+                }
+            }
+        });
+
+    std::vector<uint8_t> isRep(n);
+    for (uint32_t i = 0; i < n; i++)
+        isRep[i] = remap[i] == i;
+    std::vector<uint32_t> newIndex;
+    uint32_t newCount = parallel_prefix_sum(isRep, newIndex, pool);
+    if (newCount == n) return n;
+
+    detail::compact_stream(mesh->mVertices, isRep, newIndex, newCount, pool);
+    detail::compact_stream(mesh->mNormals, isRep, newIndex, newCount, pool);
+    detail::compact_stream(mesh->mTangents, isRep, newIndex, newCount, pool);
+    detail::compact_stream(mesh->mBitangents, isRep, newIndex, newCount, pool);
+    for (auto& uv : mesh->mTextureCoords)
+        detail::compact_stream(uv, isRep, newIndex, newCount, pool);
+    for (auto& color : mesh->mColors)
+        detail::compact_stream(color, isRep, newIndex, newCount, pool);
+
+    pool.parallel_for(mesh->mNumFaces,
+                      grain,
+                      [&](size_t begin, size_t end)
+                      {
+                          for (size_t f = begin; f < end; f++)
+                          {
+                              aiFace& face = mesh->mFaces[f];
+                              for (unsigned int k = 0; k < face.mNumIndices; k++)
+                                  face.mIndices[k] =
+                                      newIndex[remap[face.mIndices[k]]];
+                          }
+                      });
+
+    mesh->mNumVertices = newCount;
+    return newCount;
+}
+
+// Smooth vertex normals for a mesh without them. Face contributions are
+// scattered into a vertex -> corner adjacency built with atomic counters,
+// then each vertex reduces its own list, so no two workers write the same
+// normal.
+inline void generate_normals(aiMesh*         mesh,
+                             NormalWeighting weighting,
+                             ThreadPool&     pool)
+{
+    uint32_t     n     = mesh->mNumVertices;
+    uint32_t     faces = mesh->mNumFaces;
+    const size_t grain = 1 << 14;
+
+    // Weighted face normal for every triangle corner
+    std::vector<glm::vec3> corner(size_t(faces) * 3, glm::vec3(0.0f));
+    pool.parallel_for(
+        faces,
+        grain,
+        [&](size_t begin, size_t end)
+        {
+            for (size_t f = begin; f < end; f++)
+            {
+                const aiFace& face = mesh->mFaces[f];
+                if (face.mNumIndices != 3) continue; // points and lines
+
+                glm::vec3 p[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    const aiVector3D& v = mesh->mVertices[face.mIndices[k]];
+                    p[k]                = glm::vec3(v.x, v.y, v.z);
+                }
+                glm::vec3 cross = glm::cross(p[1] - p[0], p[2] - p[0]);
+                float     len   = glm::length(cross);
+                if (len <= 0.0f) continue;
+
+                for (int k = 0; k < 3; k++)
+                {
+                    if (weighting == NormalWeighting::AREA)
+                    {
+                        corner[f * 3 + k] = cross; // length is twice the area
+                        continue;
+                    }
+                    glm::vec3 e0 = p[(k + 1) % 3] - p[k];
+                    glm::vec3 e1 = p[(k + 2) % 3] - p[k];
+                    float     l0 = glm::length(e0), l1 = glm::length(e1);
+                    if (l0 <= 0.0f || l1 <= 0.0f) continue;
+                    float angle = std::acos(
+                        glm::clamp(glm::dot(e0, e1) / (l0 * l1), -1.0f, 1.0f));
+                    corner[f * 3 + k] = cross / len * angle;
+                }
+            }
+        });
+
+    // Vertex -> corner adjacency
+    std::vector<std::atomic<uint32_t>> counts(size_t(n) + 1);
+    pool.parallel_for(faces,
+                      grain,
+                      [&](size_t begin, size_t end)
+                      {
+                          for (size_t f = begin; f < end; f++)
+                          {
+                              const aiFace& face = mesh->mFaces[f];
+                              if (face.mNumIndices != 3) continue;
+                              for (int k = 0; k < 3; k++)
+                                  counts[face.mIndices[k] + 1].fetch_add(
+                                      1, std::memory_order_relaxed);
+                          }
+                      });
+    std::vector<uint32_t> offsets(size_t(n) + 1, 0);
+    for (uint32_t v = 0; v < n; v++)
+        offsets[v + 1] = offsets[v] + counts[v + 1].load();
+    for (uint32_t v = 0; v <= n; v++)
+        counts[v].store(offsets[v]);
+
+    std::vector<uint32_t> adjacency(offsets[n]);
+    pool.parallel_for(faces,
+                      grain,
+                      [&](size_t begin, size_t end)
+                      {
+                          for (size_t f = begin; f < end; f++)
+                          {
+                              const aiFace& face = mesh->mFaces[f];
+                              if (face.mNumIndices != 3) continue;
+                              for (int k = 0; k < 3; k++)
+                              {
+                                  uint32_t slot = counts[face.mIndices[k]].fetch_add(
+                                      1, std::memory_order_relaxed);
+                                  adjacency[slot] = uint32_t(f * 3 + k);
+                              }
+                          }
+                      });
+
+    aiVector3D* normals = new aiVector3D[n];
+    pool.parallel_for(
+        n,
+        grain,
+        [&](size_t begin, size_t end)
+        {
+            for (size_t v = begin; v < end; v++)
+            {
+                // Sort so the float sum does not depend on thread timing
+                auto first = adjacency.begin() + offsets[v];
+                auto last  = adjacency.begin() + offsets[v + 1];
+                std::sort(first, last);
+
+                glm::vec3 sum(0.0f);
+                for (auto it = first; it != last; ++it)
+                    sum += corner[*it];
+                float len = glm::length(sum);
+                glm::vec3 normal = len > 0.0f ? sum / len
+                                              : glm::vec3(0.0f, 1.0f, 0.0f);
+                normals[v] = aiVector3D(normal.x, normal.y, normal.z);
+            }
+        });
+
+    delete[] mesh->mNormals;
+    mesh->mNormals = normals;
+}
+
+// Welds every mesh and generates normals where missing. A non-positive
+// `weldEpsilon` picks 1e-5 of the scene's bounding box diagonal.
+inline PostProcessStats post_process_scene(const aiScene*  scene,
+                                    float           weldEpsilon,
+                                    NormalWeighting weighting,
+                                    ThreadPool&     pool)
+{
+    PostProcessStats stats;
+    using Clock = std::chrono::steady_clock;
+
+    if (weldEpsilon <= 0.0f)
+    {
+        glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+        for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+        {
+            const aiMesh* mesh = scene->mMeshes[m];
+            for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+            {
+                const aiVector3D& p = mesh->mVertices[i];
+                lo = glm::min(lo, glm::vec3(p.x, p.y, p.z));
+                hi = glm::max(hi, glm::vec3(p.x, p.y, p.z));
+            }
+        }
+        weldEpsilon = std::max(glm::length(hi - lo) * 1e-5f, FLT_MIN);
+    }
+
+    auto start = Clock::now();
+    for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+    {
+        stats.verticesBefore += scene->mMeshes[m]->mNumVertices;
+        stats.verticesAfter += weld_vertices(scene->mMeshes[m], weldEpsilon, pool);
+    }
+    auto welded = Clock::now();
+
+    for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+    {
+        aiMesh* mesh = scene->mMeshes[m];
+        if (mesh->HasNormals()) continue;
+        generate_normals(mesh, weighting, pool);
+        stats.meshesNormals++;
+    }
+    auto done = Clock::now();
+
+    stats.weldMs = std::chrono::duration<double, std::milli>(welded - start)
+                       .count();
+    stats.normalsMs = std::chrono::duration<double, std::milli>(done - welded)
+                          .count();
+    return stats;
+}
+
+// Re-imports `path` and times Assimp's own JoinIdenticalVertices and
+// GenNormals steps (in the order Assimp runs them) against `ours`
+inline void compare_with_assimp(const std::string&      path,
+                                const PostProcessStats& ours)
+{
+    using Clock = std::chrono::steady_clock;
+    auto ms     = [](Clock::time_point a, Clock::time_point b)
+    { return std::chrono::duration<double, std::milli>(b - a).count(); };
+
+    Assimp::Importer importer;
+    if (!importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs))
+    {
+        std::cerr << "compare-post: " << importer.GetErrorString() << '\n';
+        return;
+    }
+    auto t0 = Clock::now();
+    importer.ApplyPostProcessing(aiProcess_GenNormals);
+    auto t1 = Clock::now();
+    importer.ApplyPostProcessing(aiProcess_JoinIdenticalVertices);
+    auto t2 = Clock::now();
+
+    double assimpNormals = ms(t0, t1), assimpWeld = ms(t1, t2);
+    auto   row = [](const char* name, double mine, double theirs)
+    {
+        std::cout << std::left << std::setw(10) << name << std::right
+                  << std::fixed << std::setprecision(2) << std::setw(12)
+                  << mine << std::setw(12) << theirs << std::setw(10)
+                  << (mine > 0.0 ? theirs / mine : 0.0) << "x\n";
+    };
+    std::cout << std::left << std::setw(10) << "Stage" << std::right
+              << std::setw(12) << "ours ms" << std::setw(12) << "assimp ms"
+              << std::setw(11) << "speedup" << '\n';
+    row("weld", ours.weldMs, assimpWeld);
+    row("normals", ours.normalsMs, assimpNormals);
+    row("total", ours.weldMs + ours.normalsMs, assimpWeld + assimpNormals);
+}
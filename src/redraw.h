@@ -0,0 +1,265 @@
+#pragma once
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <chrono>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+
+// Everything the cached scene image depends on. The view is redrawn only
+// when this changes (or the window is resized).
+struct ViewState
+{
+    glm::mat4 view{ 0.0f };
+    int       mode           = -1;
+    bool      boundingBox    = false;
+    size_t    textureChanges = 0; // TextureStreamer::Changes
+
+    bool operator==(const ViewState& o) const
+    {
+        return view == o.view && mode == o.mode &&
+               boundingBox == o.boundingBox &&
+               textureChanges == o.textureChanges;
+    }
+    bool operator!=(const ViewState& o) const { return !(*this == o); }
+};
+
+// The last frame of the interactive view, kept offscreen so an expose or
+// an overlay-only change presents it again without redrawing the scene.
+// The debug overlay lives in its own premultiplied texture, re-rendered
+// only when its text changes, and is blended on top when presenting.
+class FrameCache
+{
+public:
+    // `compositeProgram` is overlay_vertex.glsl + overlay_fragment.glsl
+    void init(unsigned int compositeProgram)
+    {
+        program_ = compositeProgram;
+        glGenVertexArrays(1, &vao_);
+    }
+
+    // Recreates the targets for a new framebuffer size. Returns true when
+    // the size changed, which invalidates both the scene and the overlay.
+    bool resize(int width, int height)
+    {
+        if (width == width_ && height == height_) return false;
+        release_targets();
+        width_  = width;
+        height_ = height;
+        if (width <= 0 || height <= 0) return true; // minimised
+
+        glGenRenderbuffers(1, &sceneColor_);
+        glBindRenderbuffer(GL_RENDERBUFFER, sceneColor_);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glGenRenderbuffers(1, &sceneDepth_);
+        glBindRenderbuffer(GL_RENDERBUFFER, sceneDepth_);
+        glRenderbufferStorage(
+            GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glGenFramebuffers(1, &sceneFbo_);
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFbo_);
+        glFramebufferRenderbuffer(
+            GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, sceneColor_);
+        glFramebufferRenderbuffer(
+            GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, sceneDepth_);
+
+        glGenTextures(1, &overlayColor_);
+        glBindTexture(GL_TEXTURE_2D, overlayColor_);
+        glTexImage2D(GL_TEXTURE_2D,
+                     0,
+                     GL_RGBA8,
+                     width,
+                     height,
+                     0,
+                     GL_RGBA,
+                     GL_UNSIGNED_BYTE,
+                     nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &overlayFbo_);
+        glBindFramebuffer(GL_FRAMEBUFFER, overlayFbo_);
+        glFramebufferTexture2D(GL_FRAMEBUFFER,
+                               GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D,
+                               overlayColor_,
+                               0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return true;
+    }
+
+    bool valid() const { return sceneFbo_ != 0; }
+
+    // Scene passes render into the cached frame until end()
+    void begin_scene() const
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFbo_);
+        glViewport(0, 0, width_, height_);
+    }
+
+    // Overlay passes render premultiplied colour into a cleared,
+    // transparent texture until end()
+    void begin_overlay() const
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, overlayFbo_);
+        glViewport(0, 0, width_, height_);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glBlendFuncSeparate(GL_SRC_ALPHA,
+                            GL_ONE_MINUS_SRC_ALPHA,
+                            GL_ONE,
+                            GL_ONE_MINUS_SRC_ALPHA);
+    }
+
+    void end() const
+    {
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Copies the cached scene into the back buffer and blends the overlay
+    // over it. The caller swaps.
+    void present(bool overlay) const
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneFbo_);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0,
+                          0,
+                          width_,
+                          height_,
+                          0,
+                          0,
+                          width_,
+                          height_,
+                          GL_COLOR_BUFFER_BIT,
+                          GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (!overlay) return;
+
+        glDisable(GL_DEPTH_TEST);
+        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        glUseProgram(program_);
+        glUniform1i(glGetUniformLocation(program_, "overlay"), 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, overlayColor_);
+        glBindVertexArray(vao_);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    void release()
+    {
+        release_targets();
+        if (vao_) glDeleteVertexArrays(1, &vao_);
+        vao_ = 0;
+    }
+
+private:
+    void release_targets()
+    {
+        if (sceneFbo_) glDeleteFramebuffers(1, &sceneFbo_);
+        if (sceneColor_) glDeleteRenderbuffers(1, &sceneColor_);
+        if (sceneDepth_) glDeleteRenderbuffers(1, &sceneDepth_);
+        if (overlayFbo_) glDeleteFramebuffers(1, &overlayFbo_);
+        if (overlayColor_) glDeleteTextures(1, &overlayColor_);
+        sceneFbo_ = sceneColor_ = sceneDepth_ = 0;
+        overlayFbo_ = overlayColor_ = 0;
+    }
+
+    unsigned int program_ = 0, vao_ = 0;
+    unsigned int sceneFbo_ = 0, sceneColor_ = 0, sceneDepth_ = 0;
+    unsigned int overlayFbo_ = 0, overlayColor_ = 0;
+    int          width_ = 0, height_ = 0;
+};
+
+// Process CPU time and GPU render time per wall-clock second, to compare
+// the idle cost of the event-driven loop with continuous redraw
+class UsageMeter
+{
+public:
+    size_t Redraws        = 0; // scene renders since the last report
+    size_t OverlayUpdates = 0;
+    size_t Presents       = 0;
+
+    void init()
+    {
+        glGenQueries(QUERY_COUNT, queries_);
+        wallStart_ = std::chrono::steady_clock::now();
+        cpuStart_  = std::clock();
+    }
+
+    // Brackets GPU work. Frames are skipped while every query is pending.
+    void begin_gpu()
+    {
+        collect();
+        timing_ = !pending_[next_];
+        if (timing_) glBeginQuery(GL_TIME_ELAPSED, queries_[next_]);
+    }
+
+    void end_gpu()
+    {
+        if (!timing_) return;
+        glEndQuery(GL_TIME_ELAPSED);
+        pending_[next_] = true;
+        next_           = (next_ + 1) % QUERY_COUNT;
+        timing_         = false;
+    }
+
+    // Prints a line and restarts the interval once `interval` seconds
+    // have passed
+    void report(double interval)
+    {
+        double wall = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - wallStart_)
+                          .count();
+        if (wall < interval) return;
+        collect();
+
+        double cpu = double(std::clock() - cpuStart_) / CLOCKS_PER_SEC;
+        std::cout << "Usage: CPU " << std::fixed << std::setprecision(1)
+                  << 100.0 * cpu / wall << "% of a core, GPU "
+                  << std::setprecision(2) << gpuMs_ / wall << " ms/s ("
+                  << std::setprecision(1) << gpuMs_ / wall / 10.0 << "%), "
+                  << Redraws / wall << " redraws/s, " << OverlayUpdates / wall
+                  << " overlay updates/s, " << Presents / wall
+                  << " presents/s\n";
+
+        Redraws = OverlayUpdates = Presents = 0;
+        gpuMs_                              = 0.0;
+        wallStart_                          = std::chrono::steady_clock::now();
+        cpuStart_                           = std::clock();
+    }
+
+private:
+    static constexpr int QUERY_COUNT = 4;
+
+    // Adds finished queries without waiting on the GPU
+    void collect()
+    {
+        for (int i = 0; i < QUERY_COUNT; i++)
+        {
+            if (!pending_[i]) continue;
+            GLint available = 0;
+            glGetQueryObjectiv(
+                queries_[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) continue;
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(queries_[i], GL_QUERY_RESULT, &ns);
+            gpuMs_ += ns / 1e6;
+            pending_[i] = false;
+        }
+    }
+
+    GLuint                                queries_[QUERY_COUNT] = {};
+    bool                                  pending_[QUERY_COUNT] = {};
+    int                                   next_                 = 0;
+    bool                                  timing_               = false;
+    double                                gpuMs_                = 0.0;
+    std::chrono::steady_clock::time_point wallStart_;
+    std::clock_t                          cpuStart_ = 0;
+};
@@ -0,0 +1,104 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Wall-clock timeline of the startup phases. Phases on worker threads
+// overlap the ones on the context thread, so each is kept with its start
+// offset and thread, and the breakdown shows where the critical path went.
+class StartupTimeline
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    StartupTimeline()
+        : start_(Clock::now()), mainThread_(std::this_thread::get_id())
+    {
+    }
+
+    // Runs fn() as the named phase on the calling thread
+    template <class F>
+    auto phase(const char* name, F&& fn) -> decltype(fn())
+    {
+        Scope scope(*this, name);
+        return fn();
+    }
+
+    double elapsed_ms() const { return ms_since_start(Clock::now()); }
+
+    // Prints every phase in start order, then the total up to now. Only
+    // the first call prints.
+    void print(const char* total)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (printed_) return;
+        printed_ = true;
+
+        std::vector<Phase> phases = phases_;
+        std::stable_sort(phases.begin(),
+                         phases.end(),
+                         [](const Phase& a, const Phase& b)
+                         { return a.startMs < b.startMs; });
+
+        std::cout << "Startup phases (start, duration, thread):\n"
+                  << std::fixed << std::setprecision(1);
+        for (const Phase& p : phases)
+            std::cout << "  " << std::left << std::setw(26) << p.name
+                      << std::right << std::setw(8) << p.startMs << " ms"
+                      << std::setw(9) << p.durationMs << " ms  "
+                      << (p.main ? "context" : "worker") << '\n';
+        std::cout << total << ": " << elapsed_ms() << " ms\n"
+                  << std::defaultfloat;
+    }
+
+private:
+    struct Phase
+    {
+        std::string name;
+        double      startMs, durationMs;
+        bool        main;
+    };
+
+    class Scope
+    {
+    public:
+        Scope(StartupTimeline& timeline, const char* name)
+            : timeline_(timeline), name_(name), begin_(Clock::now())
+        {
+        }
+        ~Scope() { timeline_.record(name_, begin_, Clock::now()); }
+
+    private:
+        StartupTimeline&  timeline_;
+        const char*       name_;
+        Clock::time_point begin_;
+    };
+
+    void record(const char*       name,
+                Clock::time_point begin,
+                Clock::time_point end)
+    {
+        bool main = std::this_thread::get_id() == mainThread_;
+        std::lock_guard<std::mutex> lock(mutex_);
+        phases_.push_back(Phase{ name,
+                                 ms_since_start(begin),
+                                 ms_since_start(end) - ms_since_start(begin),
+                                 main });
+    }
+
+    double ms_since_start(Clock::time_point t) const
+    {
+        return std::chrono::duration<double, std::milli>(t - start_).count();
+    }
+
+    Clock::time_point  start_;
+    std::thread::id    mainThread_;
+    std::mutex         mutex_;
+    std::vector<Phase> phases_;
+    bool               printed_ = false;
+};
@@ -0,0 +1,236 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Block-compressed formats written by the texture converter
+enum class BlockFormat : std::uint8_t
+{
+    BC1, // RGB, 8 bytes per block
+    BC3, // RGBA, 16 bytes per block
+    BC5, // two-channel normal maps, 16 bytes per block
+};
+
+inline size_t block_bytes(BlockFormat fmt)
+{
+    return fmt == BlockFormat::BC1 ? 8 : 16;
+}
+
+inline size_t compressed_size(BlockFormat fmt, uint32_t w, uint32_t h)
+{
+    return size_t((w + 3) / 4) * ((h + 3) / 4) * block_bytes(fmt);
+}
+
+struct Image
+{
+    uint32_t             width  = 0;
+    uint32_t             height = 0;
+    std::vector<uint8_t> rgba; // 4 bytes per texel
+};
+
+// Box-filters one level down. Normal maps are renormalised so filtered
+// normals keep unit length.
+Image downsample(const Image& src, bool normalMap)
+{
+    Image dst;
+    dst.width  = std::max(1U, src.width / 2);
+    dst.height = std::max(1U, src.height / 2);
+    dst.rgba.resize(size_t(dst.width) * dst.height * 4);
+
+    for (uint32_t y = 0; y < dst.height; y++)
+        for (uint32_t x = 0; x < dst.width; x++)
+        {
+            uint32_t x0 = std::min(x * 2, src.width - 1);
+            uint32_t x1 = std::min(x * 2 + 1, src.width - 1);
+            uint32_t y0 = std::min(y * 2, src.height - 1);
+            uint32_t y1 = std::min(y * 2 + 1, src.height - 1);
+
+            float sum[4] = {};
+            for (uint32_t sy : { y0, y1 })
+                for (uint32_t sx : { x0, x1 })
+                    for (int c = 0; c < 4; c++)
+                        sum[c] += src.rgba[(size_t(sy) * src.width + sx) * 4 + c];
+
+            if (normalMap)
+            {
+                float n[3], len = 0.0f;
+                for (int c = 0; c < 3; c++)
+                {
+                    n[c] = sum[c] / (4.0f * 127.5f) - 1.0f;
+                    len += n[c] * n[c];
+                }
+                len = len > 0.0f ? std::sqrt(len) : 1.0f;
+                for (int c = 0; c < 3; c++)
+                    sum[c] = (n[c] / len + 1.0f) * 127.5f * 4.0f;
+            }
+
+            uint8_t* out = &dst.rgba[(size_t(y) * dst.width + x) * 4];
+            for (int c = 0; c < 4; c++)
+                out[c] = uint8_t(std::clamp(sum[c] / 4.0f + 0.5f, 0.0f, 255.0f));
+        }
+    return dst;
+}
+
+// Full mip chain down to 1x1, level 0 first
+std::vector<Image> build_mip_chain(Image base, bool normalMap)
+{
+    std::vector<Image> levels;
+    levels.push_back(std::move(base));
+    while (levels.back().width > 1 || levels.back().height > 1)
+        levels.push_back(downsample(levels.back(), normalMap));
+    return levels;
+}
+
+namespace detail
+{
+    // Copies the 4x4 block at (bx, by), clamping at the image edge
+    inline void fetch_block(const Image& img,
+                            uint32_t     bx,
+                            uint32_t     by,
+                            uint8_t      block[16][4])
+    {
+        for (uint32_t y = 0; y < 4; y++)
+            for (uint32_t x = 0; x < 4; x++)
+            {
+                uint32_t sx = std::min(bx * 4 + x, img.width - 1);
+                uint32_t sy = std::min(by * 4 + y, img.height - 1);
+                std::memcpy(block[y * 4 + x],
+                            &img.rgba[(size_t(sy) * img.width + sx) * 4],
+                            4);
+            }
+    }
+
+    inline uint16_t to_565(const float c[3])
+    {
+        auto q = [](float v, int maxValue)
+        {
+            return uint16_t(std::clamp(v / 255.0f * maxValue + 0.5f,
+                                       0.0f,
+                                       float(maxValue)));
+        };
+        return uint16_t((q(c[0], 31) << 11) | (q(c[1], 63) << 5) | q(c[2], 31));
+    }
+
+    inline void from_565(uint16_t v, float c[3])
+    {
+        c[0] = float((v >> 11) & 31) * 255.0f / 31.0f;
+        c[1] = float((v >> 5) & 63) * 255.0f / 63.0f;
+        c[2] = float(v & 31) * 255.0f / 31.0f;
+    }
+
+    // Endpoints from the block's bounding box, inset by 1/16 to reduce the
+    // error of the extremes, indices by projection onto the endpoint line
+    inline void encode_bc1_block(const uint8_t block[16][4], uint8_t out[8])
+    {
+        float lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 };
+        for (int i = 0; i < 16; i++)
+            for (int c = 0; c < 3; c++)
+            {
+                lo[c] = std::min(lo[c], float(block[i][c]));
+                hi[c] = std::max(hi[c], float(block[i][c]));
+            }
+        for (int c = 0; c < 3; c++)
+        {
+            float inset = (hi[c] - lo[c]) / 16.0f;
+            lo[c] += inset;
+            hi[c] -= inset;
+        }
+
+        uint16_t c0 = to_565(hi), c1 = to_565(lo);
+        uint32_t indices = 0;
+        if (c0 < c1) std::swap(c0, c1);
+        if (c0 != c1)
+        {
+            float e0[3], e1[3], axis[3], len2 = 0.0f;
+            from_565(c0, e0);
+            from_565(c1, e1);
+            for (int c = 0; c < 3; c++)
+            {
+                axis[c] = e1[c] - e0[c];
+                len2 += axis[c] * axis[c];
+            }
+            // Position along c0 -> c1 to the 4-colour palette order
+            const uint32_t remap[4] = { 0, 2, 3, 1 };
+            for (int i = 0; i < 16; i++)
+            {
+                float t = 0.0f;
+                for (int c = 0; c < 3; c++)
+                    t += (float(block[i][c]) - e0[c]) * axis[c];
+                t          = std::clamp(t / len2, 0.0f, 1.0f);
+                uint32_t k = uint32_t(t * 3.0f + 0.5f);
+                indices |= remap[k] << (2 * i);
+            }
+        }
+
+        out[0] = uint8_t(c0 & 0xFF);
+        out[1] = uint8_t(c0 >> 8);
+        out[2] = uint8_t(c1 & 0xFF);
+        out[3] = uint8_t(c1 >> 8);
+        for (int b = 0; b < 4; b++)
+            out[4 + b] = uint8_t(indices >> (8 * b));
+    }
+
+    // Single channel block in 8-value mode (a0 > a1)
+    inline void encode_bc4_block(const uint8_t block[16][4],
+                                 int           channel,
+                                 uint8_t       out[8])
+    {
+        uint8_t lo = 255, hi = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            lo = std::min(lo, block[i][channel]);
+            hi = std::max(hi, block[i][channel]);
+        }
+
+        uint64_t bits = 0;
+        if (hi != lo)
+        {
+            // Position k along hi -> lo; code 0 is hi, 1 is lo, 2..7 between
+            const uint64_t remap[8] = { 0, 2, 3, 4, 5, 6, 7, 1 };
+            for (int i = 0; i < 16; i++)
+            {
+                float    t = float(hi - block[i][channel]) / float(hi - lo);
+                uint32_t k = uint32_t(t * 7.0f + 0.5f);
+                bits |= remap[k] << (3 * i);
+            }
+        }
+
+        out[0] = hi;
+        out[1] = lo;
+        for (int b = 0; b < 6; b++)
+            out[2 + b] = uint8_t(bits >> (8 * b));
+    }
+} // namespace detail
+
+// Compresses one mip level; the output is block rows top to bottom
+std::vector<uint8_t> compress_image(const Image& img, BlockFormat fmt)
+{
+    uint32_t             blocksX = (img.width + 3) / 4;
+    uint32_t             blocksY = (img.height + 3) / 4;
+    std::vector<uint8_t> out(compressed_size(fmt, img.width, img.height));
+
+    uint8_t block[16][4];
+    for (uint32_t by = 0; by < blocksY; by++)
+        for (uint32_t bx = 0; bx < blocksX; bx++)
+        {
+            detail::fetch_block(img, bx, by, block);
+            uint8_t* dst = &out[(size_t(by) * blocksX + bx) * block_bytes(fmt)];
+            switch (fmt)
+            {
+            case BlockFormat::BC1:
+                detail::encode_bc1_block(block, dst);
+                break;
+            case BlockFormat::BC3:
+                detail::encode_bc4_block(block, 3, dst);
+                detail::encode_bc1_block(block, dst + 8);
+                break;
+            case BlockFormat::BC5:
+                detail::encode_bc4_block(block, 0, dst);
+                detail::encode_bc4_block(block, 1, dst + 8);
+                break;
+            }
+        }
+    return out;
+}
@@ -0,0 +1,526 @@
+#pragma once
+#include "ktx2.h"
+#include "texture_compress.h"
+#include "thread_pool.h"
+#include <glad/glad.h>
+#include <assimp/scene.h>
+#include <stb_image.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Material
+{
+    int diffuseTexture = -1; // TextureStreamer ids, -1 if absent
+    int normalTexture  = -1;
+};
+
+// KTX2 files behind a Material, empty when absent
+struct MaterialPaths
+{
+    std::string diffuse;
+    std::string normal;
+};
+
+// Decodes an image (file, or embedded in the model) and writes it as a
+// block-compressed KTX2 file with a full mip chain. Skipped when the KTX2
+// file already exists and is newer than the source file.
+bool convert_texture(const std::string& srcPath,
+                     const aiTexture*   embedded,
+                     const std::string& ktxPath,
+                     bool               normalMap)
+{
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    if (fs::exists(ktxPath, ec) &&
+        (embedded || fs::last_write_time(ktxPath, ec) >=
+                         fs::last_write_time(srcPath, ec)))
+        return true;
+
+    Image img;
+    int   w = 0, h = 0, channels = 0;
+    if (embedded && embedded->mHeight == 0)
+    {
+        // Compressed file data (png, jpg, ...) stored in the model
+        stbi_uc* pixels = stbi_load_from_memory(
+            reinterpret_cast<const stbi_uc*>(embedded->pcData),
+            static_cast<int>(embedded->mWidth),
+            &w,
+            &h,
+            &channels,
+            4);
+        if (!pixels)
+        {
+            std::cerr << "Failed to decode embedded texture: "
+                      << stbi_failure_reason() << '\n';
+            return false;
+        }
+        img.rgba.assign(pixels, pixels + size_t(w) * h * 4);
+        stbi_image_free(pixels);
+    }
+    else if (embedded)
+    {
+        // Raw BGRA texels
+        w = static_cast<int>(embedded->mWidth);
+        h = static_cast<int>(embedded->mHeight);
+        img.rgba.resize(size_t(w) * h * 4);
+        for (size_t i = 0; i < size_t(w) * h; i++)
+        {
+            const aiTexel& t    = embedded->pcData[i];
+            img.rgba[i * 4]     = t.r;
+            img.rgba[i * 4 + 1] = t.g;
+            img.rgba[i * 4 + 2] = t.b;
+            img.rgba[i * 4 + 3] = t.a;
+        }
+    }
+    else
+    {
+        stbi_uc* pixels = stbi_load(srcPath.c_str(), &w, &h, &channels, 4);
+        if (!pixels)
+        {
+            std::cerr << "Failed to load texture " << srcPath << ": "
+                      << stbi_failure_reason() << '\n';
+            return false;
+        }
+        img.rgba.assign(pixels, pixels + size_t(w) * h * 4);
+        stbi_image_free(pixels);
+    }
+    img.width  = static_cast<uint32_t>(w);
+    img.height = static_cast<uint32_t>(h);
+
+    BlockFormat fmt = BlockFormat::BC5;
+    if (!normalMap)
+    {
+        bool hasAlpha = false;
+        for (size_t i = 3; i < img.rgba.size() && !hasAlpha; i += 4)
+            hasAlpha = img.rgba[i] < 255;
+        fmt = hasAlpha ? BlockFormat::BC3 : BlockFormat::BC1;
+    }
+
+    std::vector<std::vector<uint8_t>> levels;
+    for (const auto& mip : build_mip_chain(std::move(img), normalMap))
+        levels.push_back(compress_image(mip, fmt));
+
+    if (!ktx2::write(ktxPath, fmt, uint32_t(w), uint32_t(h), levels))
+    {
+        std::cerr << "Failed to write " << ktxPath << '\n';
+        return false;
+    }
+    return true;
+}
+
+// Streams KTX2 mip levels into GL textures within a GPU memory budget.
+// Textures start out empty. Every update() requests the next finer level of
+// the coarsest textures first, a worker thread reads the level from disk,
+// and the upload happens on the GL thread, limited per frame. Levels are
+// evicted finest-first when the budget shrinks.
+class TextureStreamer
+{
+public:
+    size_t BudgetBytes         = size_t(256) << 20;
+    size_t UploadBytesPerFrame = size_t(16) << 20;
+
+    // Stats for the overlay
+    size_t ResidentBytes = 0;
+    size_t TotalBytes    = 0; // all levels of all textures
+    size_t QueuedLevels  = 0;
+    size_t Changes       = 0; // levels uploaded or evicted so far
+
+    TextureStreamer() : worker_([this] { worker_loop(); }) {}
+
+    ~TextureStreamer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        worker_.join();
+    }
+
+    TextureStreamer(const TextureStreamer&)            = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    // Returns the texture id, or -1 if the file or format is unusable
+    int add(const std::string& ktxPath)
+    {
+        Texture t;
+        if (!t.file.open(ktxPath))
+        {
+            std::cerr << "Failed to open " << ktxPath << '\n';
+            return -1;
+        }
+
+        bool s3tc = GLAD_GL_EXT_texture_compression_s3tc;
+        switch (t.file.format())
+        {
+        case BlockFormat::BC1:
+            t.glFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+            break;
+        case BlockFormat::BC3:
+            t.glFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+            break;
+        case BlockFormat::BC5:
+            t.glFormat = GL_COMPRESSED_RG_RGTC2;
+            s3tc       = true; // core since GL 3.0
+            break;
+        }
+        if (!s3tc)
+        {
+            std::cerr << "S3TC unsupported, skipping " << ktxPath << '\n';
+            return -1;
+        }
+
+        uint32_t levels = t.file.level_count();
+        t.residentLevel = levels;
+        for (uint32_t l = 0; l < levels; l++)
+            TotalBytes += t.file.level_size(l);
+
+        glGenTextures(1, &t.id);
+        glBindTexture(GL_TEXTURE_2D, t.id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(
+            GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(levels - 1));
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, GLint(levels - 1));
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        textures_.push_back(std::move(t));
+        return int(textures_.size() - 1);
+    }
+
+    // True once at least the smallest mip is on the GPU
+    bool resident(int id) const
+    {
+        return id >= 0 && textures_[id].residentLevel <
+                              textures_[id].file.level_count();
+    }
+
+    unsigned int texture(int id) const { return textures_[id].id; }
+
+    size_t texture_count() const { return textures_.size(); }
+
+    // Number of textures with their full-resolution level resident
+    size_t full_res_count() const
+    {
+        return size_t(std::count_if(textures_.begin(),
+                                    textures_.end(),
+                                    [](const Texture& t)
+                                    { return t.residentLevel == 0; }));
+    }
+
+    // True when nothing is being read or waiting for upload, i.e. update()
+    // found no further level that fits the budget
+    bool settled() const { return inFlightBytes_ == 0 && ready_.empty(); }
+
+    // Call once per frame on the GL thread
+    void update()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto& l : completed_)
+                ready_.push_back(std::move(l));
+            completed_.clear();
+        }
+
+        size_t uploaded = 0;
+        while (!ready_.empty() && uploaded < UploadBytesPerFrame)
+        {
+            LevelData& l = ready_.front();
+            Texture&   t = textures_[l.texture];
+            if (l.data.empty())
+            {
+                // The read failed: keep the coarser levels, stop retrying
+                t.inFlight     = false;
+                t.readFailed   = true;
+                inFlightBytes_ -= t.file.level_size(l.level);
+                ready_.pop_front();
+                continue;
+            }
+            glBindTexture(GL_TEXTURE_2D, t.id);
+            glCompressedTexImage2D(GL_TEXTURE_2D,
+                                   GLint(l.level),
+                                   t.glFormat,
+                                   GLsizei(t.file.level_width(l.level)),
+                                   GLsizei(t.file.level_height(l.level)),
+                                   0,
+                                   GLsizei(l.data.size()),
+                                   l.data.data());
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, GLint(l.level));
+
+            t.residentLevel = l.level;
+            t.inFlight      = false;
+            ResidentBytes += l.data.size();
+            Changes++;
+            inFlightBytes_ -= l.data.size();
+            uploaded += l.data.size();
+            ready_.pop_front();
+        }
+
+        evict_over_budget();
+        request_levels();
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        QueuedLevels = requests_.size() + ready_.size();
+    }
+
+private:
+    struct Texture
+    {
+        ktx2::File   file;
+        unsigned int id            = 0;
+        GLenum       glFormat      = 0;
+        uint32_t     residentLevel = 0; // finest level on the GPU
+        bool         inFlight      = false;
+        bool         readFailed    = false; // no finer level is requested
+    };
+
+    struct LevelData
+    {
+        int                  texture;
+        const ktx2::File*    file; // stable, textures_ is a deque
+        uint32_t             level;
+        std::vector<uint8_t> data;
+    };
+
+    void evict_over_budget()
+    {
+        while (ResidentBytes > BudgetBytes)
+        {
+            // Drop the finest level of the most detailed texture
+            Texture* victim = nullptr;
+            for (auto& t : textures_)
+                if (!t.inFlight && t.residentLevel + 1 < t.file.level_count() &&
+                    (!victim || t.residentLevel < victim->residentLevel))
+                    victim = &t;
+            if (!victim) break;
+
+            uint32_t level = victim->residentLevel;
+            glBindTexture(GL_TEXTURE_2D, victim->id);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, GLint(level + 1));
+            // A zero-sized image releases the level's storage
+            glCompressedTexImage2D(
+                GL_TEXTURE_2D, GLint(level), victim->glFormat, 0, 0, 0, 0, nullptr);
+            victim->residentLevel = level + 1;
+            ResidentBytes -= victim->file.level_size(level);
+            Changes++;
+        }
+    }
+
+    void request_levels()
+    {
+        const size_t maxInFlight = 8;
+
+        std::vector<int> order;
+        for (size_t i = 0; i < textures_.size(); i++)
+            if (!textures_[i].inFlight && !textures_[i].readFailed &&
+                textures_[i].residentLevel > 0)
+                order.push_back(int(i));
+        // Coarsest first, so every texture gets a usable level before any
+        // texture gets its full resolution
+        std::sort(order.begin(),
+                  order.end(),
+                  [this](int a, int b)
+                  {
+                      return textures_[a].residentLevel >
+                             textures_[b].residentLevel;
+                  });
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (int i : order)
+        {
+            if (requests_.size() + ready_.size() >= maxInFlight) break;
+
+            Texture& t     = textures_[i];
+            uint32_t level = t.residentLevel - 1;
+            size_t   bytes = t.file.level_size(level);
+            if (ResidentBytes + inFlightBytes_ + bytes > BudgetBytes) break;
+
+            t.inFlight = true;
+            inFlightBytes_ += bytes;
+            requests_.push_back({ i, &t.file, level, {} });
+        }
+        wake_.notify_one();
+    }
+
+    void worker_loop()
+    {
+        for (;;)
+        {
+            LevelData request;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock,
+                           [this] { return stopping_ || !requests_.empty(); });
+                if (stopping_) return;
+                request = std::move(requests_.front());
+                requests_.pop_front();
+            }
+
+            // An empty level tells update() the read failed
+            if (!request.file->read_level(request.level, request.data))
+            {
+                std::cerr << "Failed to read mip " << request.level << '\n';
+                request.data.clear();
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            completed_.push_back(std::move(request));
+        }
+    }
+
+    std::deque<Texture>   textures_;
+    std::deque<LevelData> ready_; // read, waiting for upload (GL thread only)
+    size_t                inFlightBytes_ = 0;
+
+    // Shared with the worker
+    std::mutex              mutex_;
+    std::condition_variable wake_;
+    std::deque<LevelData>   requests_;
+    std::vector<LevelData>  completed_;
+    bool                    stopping_ = false;
+    std::thread             worker_;
+};
+
+// Registers already converted textures, e.g. from a mesh cache
+std::vector<Material> add_materials(const std::vector<MaterialPaths>& paths,
+                                    TextureStreamer&                  streamer)
+{
+    std::map<std::string, int> ids;
+    auto                       add = [&](const std::string& path)
+    {
+        if (path.empty()) return -1;
+        auto it = ids.find(path);
+        if (it != ids.end()) return it->second;
+        return ids[path] = streamer.add(path);
+    };
+
+    std::vector<Material> materials(std::max<size_t>(1, paths.size()));
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        materials[i].diffuseTexture = add(paths[i].diffuse);
+        materials[i].normalTexture  = add(paths[i].normal);
+    }
+    return materials;
+}
+
+// Converts every texture referenced by the scene's materials (in parallel on
+// the pool) and registers the results with the streamer. `paths`, when
+// given, receives the KTX2 files behind each material.
+std::vector<Material> load_materials(const aiScene*              scene,
+                                     const std::string&          modelPath,
+                                     ThreadPool&                 pool,
+                                     TextureStreamer&            streamer,
+                                     std::vector<MaterialPaths>* paths = nullptr)
+{
+    namespace fs = std::filesystem;
+    fs::path modelDir = fs::path(modelPath).parent_path();
+
+    struct Source
+    {
+        std::string      path;
+        const aiTexture* embedded;
+        std::string      ktxPath;
+        bool             normalMap;
+        bool             converted;
+    };
+    std::vector<Source>        sources;
+    std::map<std::string, int> sourceIds; // ktx path -> index into sources
+
+    auto find_texture = [&](const aiMaterial* mat, bool normalMap) -> int
+    {
+        // OBJ files put normal maps in map_bump, which Assimp calls HEIGHT
+        aiTextureType types[2] = { aiTextureType_DIFFUSE,
+                                   aiTextureType_BASE_COLOR };
+        if (normalMap)
+        {
+            types[0] = aiTextureType_NORMALS;
+            types[1] = aiTextureType_HEIGHT;
+        }
+
+        aiString name;
+        bool     found = false;
+        for (auto type : types)
+            if (mat->GetTextureCount(type) > 0 &&
+                mat->GetTexture(type, 0, &name) == aiReturn_SUCCESS)
+            {
+                found = true;
+                break;
+            }
+        if (!found) return -1;
+
+        Source src{};
+        src.normalMap = normalMap;
+        src.embedded  = scene->GetEmbeddedTexture(name.C_Str());
+        std::string suffix = normalMap ? ".normal.ktx2" : ".ktx2";
+        if (src.embedded)
+        {
+            std::string id = name.C_Str();
+            std::replace(id.begin(), id.end(), '*', '_');
+            src.ktxPath = modelPath + id + suffix;
+        }
+        else
+        {
+            std::string file = name.C_Str();
+            std::replace(file.begin(), file.end(), '\\', '/');
+            src.path    = (modelDir / file).string();
+            src.ktxPath = src.path + suffix;
+        }
+
+        auto it = sourceIds.find(src.ktxPath);
+        if (it != sourceIds.end()) return it->second;
+        sources.push_back(src);
+        sourceIds[src.ktxPath] = int(sources.size() - 1);
+        return int(sources.size() - 1);
+    };
+
+    std::vector<Material> materials(std::max(1U, scene->mNumMaterials));
+    for (unsigned int i = 0; i < scene->mNumMaterials; i++)
+    {
+        materials[i].diffuseTexture = find_texture(scene->mMaterials[i], false);
+        materials[i].normalTexture  = find_texture(scene->mMaterials[i], true);
+    }
+
+    pool.parallel_for(sources.size(),
+                      1,
+                      [&](size_t begin, size_t end)
+                      {
+                          for (size_t i = begin; i < end; i++)
+                              sources[i].converted = convert_texture(
+                                  sources[i].path,
+                                  sources[i].embedded,
+                                  sources[i].ktxPath,
+                                  sources[i].normalMap);
+                      });
+
+    std::vector<int> streamIds(sources.size(), -1);
+    for (size_t i = 0; i < sources.size(); i++)
+        if (sources[i].converted) streamIds[i] = streamer.add(sources[i].ktxPath);
+
+    if (paths) paths->assign(materials.size(), MaterialPaths{});
+    for (size_t i = 0; i < materials.size(); i++)
+    {
+        Material& m = materials[i];
+        if (paths && m.diffuseTexture >= 0 && streamIds[m.diffuseTexture] >= 0)
+            (*paths)[i].diffuse = sources[m.diffuseTexture].ktxPath;
+        if (paths && m.normalTexture >= 0 && streamIds[m.normalTexture] >= 0)
+            (*paths)[i].normal = sources[m.normalTexture].ktxPath;
+
+        if (m.diffuseTexture >= 0) m.diffuseTexture = streamIds[m.diffuseTexture];
+        if (m.normalTexture >= 0) m.normalTexture = streamIds[m.normalTexture];
+    }
+
+    std::cout << "Textures: " << streamer.texture_count() << " streamed, "
+              << (streamer.TotalBytes >> 20) << " MB with all mips" << '\n';
+    return materials;
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed-size worker pool shared by the CPU-side passes
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned int threads = default_thread_count())
+    {
+        for (unsigned int i = 0; i < threads; i++)
+            workers_.emplace_back([this] { worker_loop(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (auto& w : workers_)
+            w.join();
+    }
+
+    ThreadPool(const ThreadPool&)            = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    static unsigned int default_thread_count()
+    {
+        return std::max(1U, std::thread::hardware_concurrency());
+    }
+
+    size_t size() const { return workers_.size(); }
+
+    // Number of tasks waiting for a worker
+    size_t pending() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return tasks_.size();
+    }
+
+    template <class F>
+    auto submit(F&& fn) -> std::future<decltype(fn())>
+    {
+        using Result = decltype(fn());
+        auto task    = std::make_shared<std::packaged_task<Result()>>(
+            std::forward<F>(fn));
+        std::future<Result> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.emplace([task] { (*task)(); });
+        }
+        wake_.notify_one();
+        return result;
+    }
+
+    // Calls fn(begin, end) over [0, count) in chunks of `grain`. The calling
+    // thread takes chunks too and only waits for chunks, never for helper
+    // tasks, so nested calls from inside a worker cannot deadlock.
+    void parallel_for(size_t                                    count,
+                      size_t                                    grain,
+                      const std::function<void(size_t, size_t)>& fn)
+    {
+        if (count == 0) return;
+        grain         = std::max<size_t>(grain, 1);
+        size_t chunks = (count + grain - 1) / grain;
+        if (chunks == 1 || workers_.empty())
+        {
+            fn(0, count);
+            return;
+        }
+
+        struct Shared
+        {
+            std::atomic<size_t>     next{ 0 };
+            std::atomic<size_t>     done{ 0 };
+            std::mutex              mutex;
+            std::condition_variable finished;
+        };
+        auto shared = std::make_shared<Shared>();
+
+        // `fn` outlives every chunk because we block until all are done
+        auto run = [shared, chunks, count, grain, &fn]
+        {
+            for (;;)
+            {
+                size_t c = shared->next.fetch_add(1);
+                if (c >= chunks) return;
+                fn(c * grain, std::min(count, (c + 1) * grain));
+                if (shared->done.fetch_add(1) + 1 == chunks)
+                {
+                    std::lock_guard<std::mutex> lock(shared->mutex);
+                    shared->finished.notify_all();
+                }
+            }
+        };
+
+        size_t helpers = std::min(chunks - 1, workers_.size());
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (size_t i = 0; i < helpers; i++)
+                tasks_.emplace(run);
+        }
+        wake_.notify_all();
+
+        run();
+        std::unique_lock<std::mutex> lock(shared->mutex);
+        shared->finished.wait(lock, [&] { return shared->done == chunks; });
+    }
+
+private:
+    void worker_loop()
+    {
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+                if (stopping_ && tasks_.empty()) return;
+                task = std::move(tasks_.front());
+                tasks_.pop();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread>          workers_;
+    std::queue<std::function<void()>> tasks_;
+    mutable std::mutex                mutex_;
+    std::condition_variable           wake_;
+    bool                              stopping_ = false;
+};
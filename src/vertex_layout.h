@@ -0,0 +1,175 @@
+#pragma once
+#include "thread_pool.h"
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+// Vertex attributes: shader location and float count
+struct Position
+{
+    static constexpr GLuint location = 0;
+    static constexpr int    size     = 3;
+};
+
+struct Normal
+{
+    static constexpr GLuint location = 1;
+    static constexpr int    size     = 3;
+};
+
+struct TexCoord
+{
+    static constexpr GLuint location = 2;
+    static constexpr int    size     = 2;
+};
+
+// Interleaved (AoS) vertex made of `Attributes` in order, as uploaded to
+// the GPU. Stride and offsets are compile-time constants, so typed CPU
+// code indexes without a runtime stride.
+template <class... Attributes>
+struct VertexLayout
+{
+    static constexpr int stride = (Attributes::size + ...);
+
+    template <class A>
+    static constexpr bool has()
+    {
+        return (std::is_same_v<A, Attributes> || ...);
+    }
+
+    // Floats before attribute A
+    template <class A>
+    static constexpr int offset()
+    {
+        static_assert(has<A>(), "attribute is not part of the layout");
+        int  offset = 0;
+        bool found  = false;
+        ((found = found || std::is_same_v<A, Attributes>,
+          offset += found ? 0 : Attributes::size),
+         ...);
+        return offset;
+    }
+
+    // Points the attributes of the bound VAO at the bound array buffer
+    static void setup_attributes()
+    {
+        (enable_attribute<Attributes>(), ...);
+    }
+
+private:
+    template <class A>
+    static void enable_attribute()
+    {
+        glVertexAttribPointer(A::location,
+                              A::size,
+                              GL_FLOAT,
+                              GL_FALSE,
+                              stride * sizeof(float),
+                              (void*)(offset<A>() * sizeof(float)));
+        glEnableVertexAttribArray(A::location);
+    }
+};
+
+// The layouts extractVertices can produce. Normals are always present.
+using LayoutPN  = VertexLayout<Position, Normal>;
+using LayoutPNT = VertexLayout<Position, Normal, TexCoord>;
+
+// Typed read access to an interleaved soup of `Layout` vertices
+template <class Layout>
+class VertexView
+{
+public:
+    VertexView(const float* vertices, size_t count)
+        : data_(vertices), count_(count)
+    {
+    }
+
+    size_t size() const { return count_; }
+
+    template <class A>
+    const float* get(size_t v) const
+    {
+        return data_ + v * Layout::stride + Layout::template offset<A>();
+    }
+
+    glm::vec3 position(size_t v) const
+    {
+        const float* p = get<Position>(v);
+        return glm::vec3(p[0], p[1], p[2]);
+    }
+
+    glm::vec3 normal(size_t v) const
+    {
+        const float* n = get<Normal>(v);
+        return glm::vec3(n[0], n[1], n[2]);
+    }
+
+private:
+    const float* data_;
+    size_t       count_;
+};
+
+// Positions split into one array per component (SoA). Bulk CPU passes
+// read contiguous floats the compiler can vectorise, while the GPU keeps
+// the interleaved soup.
+struct PositionStreams
+{
+    std::vector<float> x, y, z;
+
+    size_t    size() const { return x.size(); }
+    glm::vec3 operator[](size_t v) const
+    {
+        return glm::vec3(x[v], y[v], z[v]);
+    }
+};
+
+template <class Layout>
+PositionStreams to_position_streams(const std::vector<float>& vertices,
+                                    ThreadPool&               pool)
+{
+    VertexView<Layout> view(vertices.data(), vertices.size() / Layout::stride);
+    PositionStreams    s;
+    s.x.resize(view.size());
+    s.y.resize(view.size());
+    s.z.resize(view.size());
+    pool.parallel_for(view.size(),
+                      1 << 16,
+                      [&](size_t begin, size_t end)
+                      {
+                          for (size_t v = begin; v < end; v++)
+                          {
+                              const float* p = view.template get<Position>(v);
+                              s.x[v]         = p[0];
+                              s.y[v]         = p[1];
+                              s.z[v]         = p[2];
+                          }
+                      });
+    return s;
+}
+
+// Bounds of `count` positions from `first`. One independent min/max per
+// component keeps each loop a plain vectorisable reduction.
+void stream_bounds(const PositionStreams& s,
+                   size_t                 first,
+                   size_t                 count,
+                   glm::vec3&             boxMin,
+                   glm::vec3&             boxMax)
+{
+    const float* streams[3] = { s.x.data(), s.y.data(), s.z.data() };
+    for (int c = 0; c < 3; c++)
+    {
+        const float* p  = streams[c] + first;
+        float        lo = FLT_MAX, hi = -FLT_MAX;
+        for (size_t v = 0; v < count; v++)
+        {
+            lo = p[v] < lo ? p[v] : lo;
+            hi = p[v] > hi ? p[v] : hi;
+        }
+        boxMin[c] = lo;
+        boxMax[c] = hi;
+    }
+}